@@ -14,24 +14,44 @@ import struct
 def unhex(str):
     return int(str, 16)
 
-def parseMem(filename, memstart, memend=None):
-    f = open(filename, 'r')
-    mem = []
+def readLines(f):
+    """Yield (addr, [(value, size), ...]) for each line of a dump,
+    expanding the '*' lines that stand for repeats of the last line."""
+    last = None
+    repeat = 0
     for line in f:
+        if line.strip() == '*':
+            repeat = 1
+            continue
         parts = line.split('|')
         if len(parts) < 2:
             continue
         try:
             vaddr = unhex(parts[0])
+            words = [(unhex(v), len(v) // 2) for v in parts[1].split()]
         except ValueError:
             continue
+        if repeat and last is not None:
+            laddr, lwords = last
+            size = sum([s for v, s in lwords])
+            laddr += size
+            while laddr < vaddr:
+                yield laddr, lwords
+                laddr += size
+        repeat = 0
+        last = (vaddr, words)
+        yield vaddr, words
+
+def parseMem(filename, memstart, memend=None):
+    f = open(filename, 'r')
+    mem = []
+    for vaddr, words in readLines(f):
         if vaddr != memstart:
             continue
         if vaddr >= memend:
             break
-        parts = parts[1].split()
-        mem.extend([unhex(v) for v in parts])
-        memstart += len(parts) * 4
+        mem.extend(words)
+        memstart += sum([s for v, s in words])
     return mem
 
 def printUsage():
@@ -46,8 +66,9 @@ def main():
     startaddr = int(sys.argv[2], 0)
     endaddr = int(sys.argv[3], 0)
     mem = parseMem(filename, startaddr, endaddr)
-    for i in mem:
-        sys.stdout.write(struct.pack("<I", i))
+    formats = {1: "<B", 2: "<H", 4: "<I"}
+    for v, size in mem:
+        sys.stdout.write(struct.pack(formats[size], v))
 
 if __name__ == '__main__':
     main()
@@ -1,5 +1,6 @@
 // Definitions for Texas Instruments OMAP processors.
 #include "machines.h" // Machine
+#include "memory.h" // struct physMapping
 
 extern "C" {
     void bootQSD8xxx(char *kernel, uint32 machtype, char *tags);
@@ -19,11 +20,15 @@ public:
 
 class MachineQSD8xxx : public Machine {
 protected:
-    void configureFb(struct fbinfo *);
+    int configureFb(struct fbinfo *);
     void shutdownInterrupts();
     void shutdownTimers();
     void shutdownSirc();
     void shutdownDMA();
+    // Register mappings made by preHardwareShutdown
+    struct physMapping vicMap, sircMap, timerMap, dmovMap;
+    struct physMapping fbDmaMap, fbStartMap;
+    uint8 *vicRegs, *sircRegs, *timerRegs, *dmovRegs;
 public:
     MachineQSD8xxx();
     void init();
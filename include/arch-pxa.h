@@ -1,4 +1,5 @@
 #include "machines.h" // Machine
+#include "memory.h" // struct physMapping
 
 // PXA 25x and 26x
 class MachinePXA : public Machine {
@@ -11,6 +12,7 @@ public:
 
     uint32 dcsr_count;
     uint32 *dma, *udc;
+    struct physMapping dmaMap, udcMap;
 };
 
 // PXA 27x
@@ -23,6 +25,7 @@ public:
     virtual void hardwareShutdown(struct fbinfo *fbi);
 
     uint32 *cken, *uhccoms;
+    struct physMapping ckenMap, uhccomsMap;
 };
 
 int testPXA();
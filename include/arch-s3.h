@@ -1,6 +1,7 @@
 //--------------------------------------------------------
 // Definitions for Samsung s3c24xx chips.
 #include "machines.h" // Machine
+#include "memory.h" // struct physMapping
 
 class MachineS3c2442 : public Machine {
 public:
@@ -26,14 +27,16 @@ protected:
     void s3c6400ShutdownDMA(struct fbinfo *fbi);
     void resetUSB(volatile unsigned char * usb_sigmask);
     void clearIRQS(void);
+    void unmapShutdownRegs();
 public:
     MachineS3c6400();
     void init();
     int preHardwareShutdown(struct fbinfo *fbi);
     void hardwareShutdown(struct fbinfo *fbi);
 
-    uint32 *usb_otgsfr, *dma_base[4];
+    uint32 *usb_otgsfr, *dma_base[4], *vic[2], *sdma_selreg;
     unsigned char *usb_sigmask;
+    struct physMapping usbOtgMap, usbSigMap, sdmaSelMap, dmaMap[4], vicMap[2];
 };
 
 // s3c6410 - assume they are the same for now.
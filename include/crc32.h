@@ -0,0 +1,50 @@
+/*
+ * Big endian CRC32 (as in linux/lib/crc32.c) for haret and the
+ * preloader.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include "xtypes.h" // uint32
+#include "linboot.h" // __preload
+
+#define CRCPOLY_BE 0x04c11db7
+#define CRC32_TABLE_SIZE 256
+
+// The preloader can't use global data, so the lookup table is built at
+// runtime into a caller supplied (CRC32_TABLE_SIZE entries) array.
+static inline void __preload
+crc32_be_init(uint32 *table)
+{
+    for (uint32 i = 0; i < CRC32_TABLE_SIZE; i++) {
+        uint32 crc = i << 24;
+        for (int j = 0; j < 8; j++)
+            crc = (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+        table[i] = crc;
+    }
+}
+
+// CRC a block of ram - one table lookup per byte.
+static inline uint32 __preload
+crc32_be(const uint32 *table, uint32 crc, const char *data, uint32 len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    while (len--)
+        crc = (crc << 8) ^ table[(crc >> 24) ^ *p++];
+    return crc;
+}
+
+static inline uint32 __preload
+crc32_be_finish(const uint32 *table, uint32 crc, uint32 len)
+{
+    for (; len; len >>= 8) {
+        unsigned char l = len;
+        crc = crc32_be(table, crc, (char *)&l, 1);
+    }
+    return ~crc & 0xFFFFFFFF;
+}
+
+#endif // _CRC32_H
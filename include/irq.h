@@ -5,6 +5,7 @@
 #include "cpu.h" // DEF_GETCPRATTR
 #include "cbitmap.h" // BITMAPSIZE
 #include "watch.h" // memcheck
+#include "memory.h" // struct physMapping
 
 // Mark a function to be available during interrupt handling.
 // Functions marked with this attribute will be relocated to an
@@ -68,6 +69,8 @@ struct irqData {
     // MMU tracing specific
     //
     uint32 *mmuVAddr;
+    // Keeps mmuVAddr mapped until the handlers are removed
+    struct physMapping mmuMap;
     uint32 redirectVAddrBase;
     uint32 alterCount, alterVAddrs[MAX_L1TRACE];
     uint32 traceCount;
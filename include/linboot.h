@@ -1,3 +1,6 @@
+#ifndef _LINBOOT_H
+#define _LINBOOT_H
+
 #include <stdio.h> // FILE
 #include "xtypes.h" // uint32
 
@@ -15,3 +18,5 @@ void bootRamLinux(const char *kernel, uint32 kernelSize
                   , int bootViaResume=0);
 void bootHandleLinux(FILE *f, int kernelSize, int initrdSize, 
 		     int bootViaResume=0);
+
+#endif // _LINBOOT_H
@@ -72,9 +72,48 @@ enum MemOps {
 
 extern uint8 *memPhysMap(uint32 paddr);
 extern void memPhysReset();
+extern void memPhysThreadDone();
+
+// A pinned mapping of physical memory (see memPhysMapRange).
+struct physMapping {
+    uint8 *vaddr;
+    uint32 paddr, size;
+    // Window held by the mapping (NULL if an existing kernel map is used)
+    struct physWindow *win;
+};
+extern uint8 *memPhysMapRange(struct physMapping *pm, uint32 paddr
+                              , uint32 size, int cached = 0);
+extern void memPhysUnmap(struct physMapping *pm);
 extern uint32 memPhysRead(uint32 paddr);
 extern bool memPhysWrite(uint32 paddr, uint32 value);
+extern void memPhysReadSync();
+extern uint32 memPhysReadBlock(void *dst, uint32 paddr, uint32 len);
+extern uint32 memPhysWriteBlock(uint32 paddr, const void *src, uint32 len);
+extern uint32 memPhysCopy(uint32 dst, uint32 src, uint32 len);
+
+// Largest number of values in a fill pattern
+#define FILL_MAXPAT 16
+
+// A pattern for memFillBlock/memPhysFillBlock.  The 'count' values of
+// size 'wordsize' are repeated and 'step' is added to all of them
+// after each repeat.  With 'addrdata' set every element is instead
+// filled with (the low bits of) its own address.
+struct fillPattern {
+    int wordsize;
+    uint32 count;
+    uint32 values[FILL_MAXPAT];
+    uint32 step;
+    int addrdata;
+    // Position reached so far - a fill continues where the last ended
+    uint32 pos, offset;
+};
+extern void fillPatternInit(struct fillPattern *pat, int wordsize
+                            , uint32 value);
+extern bool memFillBlock(uint8 *vaddr, uint32 len, struct fillPattern *pat);
+extern uint32 memPhysFillBlock(uint32 paddr, uint32 len
+                               , struct fillPattern *pat);
 extern uint32 memVirtToPhys(uint32 vaddr);
+extern void memVirtToPhysFlush();
 uint32 retryVirtToPhys(uint32 vaddr);
 void *cachedMVA(void *addr);
 
@@ -88,6 +127,8 @@ struct pageinfo {
 
 const struct pageinfo *getL1Desc(uint32 l1d);
 const struct pageinfo *getL2Desc(uint32 l2d);
+// ARMv6 mmu with the subpage AP bits disabled (cp15 r1 bit 23)
+extern int Arm6NoSubPages;
 
 struct pageAddrs {
     uint32 physLoc;
@@ -117,7 +158,7 @@ void *allocContPages(int pageCount, struct continuousPageInfo **info);
             IN_RANGE(__start1 + __size1 - 1, __start2, __size2 + __size1 - 1); \
         })
 
-// The size of physical memory to map at once
+// The default (and minimum) size of physical memory to map at once
 #define PHYS_CACHE_SIZE 0x10000
 #define PHYS_CACHE_MASK (PHYS_CACHE_SIZE - 1)
 
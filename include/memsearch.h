@@ -0,0 +1,47 @@
+/* Pattern search engine used by PSEARCH and VSEARCH.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#ifndef _MEMSEARCH_H
+#define _MEMSEARCH_H
+
+#include "xtypes.h" // uint32
+
+// Longest pattern (in bytes) supported by [P|V]SEARCH
+#define SEARCH_MAXPAT 64
+
+struct searchPattern {
+    // Word patterns are compared (under a mask) at word aligned
+    // addresses - string patterns at any byte offset.
+    int isWord;
+    uint32 len;
+    uint32 words[SEARCH_MAXPAT / 4], masks[SEARCH_MAXPAT / 4];
+    uint8 bytes[SEARCH_MAXPAT];
+    // Horspool skip table - indexed by the last byte (or the low byte
+    // of the last word) under the search window.
+    uint32 shift[256];
+    // Called for each match (in increasing address order)
+    void (*hit)(struct searchPattern *sp, uint32 addr);
+    uint32 count;
+};
+
+// Copies 'len' bytes at 'addr' to 'dst' - returns the number of bytes
+// copied (less than 'len' if the rest can't be read).
+typedef uint32 (*searchReadFunc)(void *dst, uint32 addr, uint32 len);
+
+// Build the skip table for a pattern.
+void searchPrepare(struct searchPattern *sp);
+// Check all pattern positions from 'from' to 'avail - sp->len' in
+// 'buf' (which holds memory starting at 'base').
+void searchBlock(struct searchPattern *sp, const uint8 *buf, uint32 from
+                 , uint32 avail, uint32 base);
+// Search 'size' bytes at 'start', read 'bufsize' bytes at a time into
+// 'buf' (word aligned, bufsize a multiple of 4 and at least
+// SEARCH_MAXPAT * 2).  'progress' (if set) is called before each
+// block.  Returns the number of bytes searched.
+uint32 searchRange(struct searchPattern *sp, uint32 start, uint32 size
+                   , uint8 *buf, uint32 bufsize, searchReadFunc read
+                   , void (*progress)(uint32 done) = 0);
+
+#endif /* _MEMSEARCH_H */
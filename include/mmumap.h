@@ -0,0 +1,36 @@
+/* Format of the mmu map files written by DUMP MMUMAP.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#ifndef _MMUMAP_H
+#define _MMUMAP_H
+
+#include "xtypes.h" // uint32
+
+// The file starts with a header followed by one record per range of
+// continuous mappings (sorted by virtual address).  All fields are
+// little endian.
+#define MMUMAP_MAGIC "HRTMMAP1"
+
+// Flags in mmuMapHeader.arch
+#define MMUMAP_ARM6MMU    0x1
+#define MMUMAP_NOSUBPAGES 0x2
+
+struct mmuMapHeader {
+    char magic[8];
+    // Physical address of the L1 table
+    uint32 mmu;
+    uint32 arch;
+};
+
+struct mmuMapRecord {
+    uint32 vaddr, paddr, size;
+    // 1 for sections, 2 for pages of an L2 table
+    uint32 level;
+    // Descriptor bits outside of the address (including the type bits)
+    uint32 flags;
+    uint32 domain;
+};
+
+#endif /* _MMUMAP_H */
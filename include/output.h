@@ -41,6 +41,8 @@ void flushLogFile();
 extern bool InitProgress(int dialogId, uint Max);
 extern bool SetProgress(uint Value);
 extern bool AddProgress(int add);
+extern void SetProgressText(const char *fmt, ...)
+    __attribute__ ((format (printf, 1, 2)));
 extern void DoneProgress();
 
 // Class used to direct output to listeners.
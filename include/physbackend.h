@@ -0,0 +1,38 @@
+/* Platform primitives used by the physical memory routines.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#ifndef _PHYSBACKEND_H
+#define _PHYSBACKEND_H
+
+#include "xtypes.h" // uint32
+
+struct pageAddrs;
+
+// The memory.cpp mapper never touches VirtualCopy, LockPages or the
+// coprocessor registers directly - it goes through one of these.  The
+// WinCE implementation lives in src/wince/physmem.cpp; src/sim/physsim.cpp
+// provides one for a Linux host that simulates physical memory.
+struct physBackend {
+    const char *name;
+    // Map 'size' bytes of physical memory at 'paddr' (both page
+    // aligned) into a new area of virtual address space.  Returns
+    // NULL on failure.
+    uint8 *(*mapPhys)(uint32 paddr, uint32 size, int cached);
+    // Release an area returned by mapPhys.
+    void (*unmapPhys)(uint8 *virt, uint32 size);
+    // Physical address of the active L1 mmu table.
+    uint32 (*mmuBase)();
+    // Convert a virtual address to a modified virtual address.
+    uint32 (*mvaddr)(uint32 vaddr);
+    // Allocate and lock 'pageCount' pages - see allocPages().
+    void *(*allocPages)(struct pageAddrs *pages, int pageCount);
+    // Release pages returned by allocPages.
+    void (*freePages)(void *data);
+};
+
+// The backend in use - defined by the backend linked into the program.
+extern struct physBackend *PhysBackend;
+
+#endif /* _PHYSBACKEND_H */
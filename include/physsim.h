@@ -0,0 +1,30 @@
+/* Linux host simulation of the physical memory primitives.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#ifndef _PHYSSIM_H
+#define _PHYSSIM_H
+
+#include "xtypes.h" // uint32
+
+// Create the simulated physical address space.  The whole 4GB space
+// is backed by the sparse file 'backing' (a temporary file if NULL);
+// RAM is the 'ramSize' bytes at 'ramAddr'.  Returns 0 on success.
+int physSimInit(uint32 ramAddr, uint32 ramSize, const char *backing = 0);
+// Release the simulated address space.
+void physSimDone();
+// Load a captured memory image (eg, from PWF) at physical 'paddr'.
+// Returns the number of bytes loaded or -1 on error.
+int physSimLoadImage(const char *filename, uint32 paddr);
+// Build a WinCE like L1/L2 table at the top of RAM: RAM is mapped with
+// cached sections at 0x80000000 and uncached sections at 0xa0000000,
+// and the first MB of RAM is mapped with (swapped halves of) small
+// pages at 0xc0000000.  Returns the table's physical address.
+uint32 physSimBuildMMU();
+// Use an existing L1 table (eg, one found in a loaded image).
+void physSimSetMMU(uint32 mmu);
+// Set the process id used to calculate modified virtual addresses.
+void physSimSetPID(uint32 pid);
+
+#endif /* _PHYSSIM_H */
@@ -27,6 +27,8 @@
 
 #define	DLG_PROGRESS		10
 #define	DLG_PROGRESS_BOOT	12
+// Text shown above the progress bar
+#define	DLG_PROGRESS_TEXT	202
 
 #define	DLG_HaRET		20
 #define	BT_LISTEN		21
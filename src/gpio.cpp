@@ -25,7 +25,10 @@ void gpioSetDir (int num, bool out)
   if (num > 84)
     return;
 
-  uint32 *gpdr = (uint32 *)memPhysMap (GPDR0);
+  struct physMapping pm;
+  uint32 *gpdr = (uint32 *)memPhysMapRange (&pm, GPDR0, 3 * 4);
+  if (!gpdr)
+    return;
   uint32 ofs = num >> 5;
   uint32 mask = 1 << (num & 31);
 
@@ -33,6 +36,7 @@ void gpioSetDir (int num, bool out)
     gpdr [ofs] |= mask;
   else
     gpdr [ofs] &= ~mask;
+  memPhysUnmap (&pm);
 }
 
 bool gpioGetDir (int num)
@@ -40,9 +44,14 @@ bool gpioGetDir (int num)
   if (num > 84)
     return false;
 
-  uint32 *gpdr = (uint32 *)memPhysMap (GPDR0);
+  struct physMapping pm;
+  uint32 *gpdr = (uint32 *)memPhysMapRange (&pm, GPDR0, 3 * 4);
+  if (!gpdr)
+    return false;
 
-  return (gpdr [num >> 5] & (1 << (num & 31))) != 0;
+  bool out = (gpdr [num >> 5] & (1 << (num & 31))) != 0;
+  memPhysUnmap (&pm);
+  return out;
 }
 
 void gpioSetAlt (int num, int altfn)
@@ -50,11 +59,15 @@ void gpioSetAlt (int num, int altfn)
   if (num > 84)
     return;
 
-  uint32 *gafr = (uint32 *)memPhysMap (GAFR0_L);
+  struct physMapping pm;
+  uint32 *gafr = (uint32 *)memPhysMapRange (&pm, GAFR0_L, 6 * 4);
+  if (!gafr)
+    return;
   uint32 ofs = num >> 4;
   uint32 shft = (num & 15) << 1;
 
   gafr [ofs] = (gafr [ofs] & ~(3 << shft)) | ((altfn & 3) << shft);
+  memPhysUnmap (&pm);
 }
 
 uint32 gpioGetAlt (int num)
@@ -62,9 +75,14 @@ uint32 gpioGetAlt (int num)
   if (num > 84)
     return -1;
 
-  uint32 *gafr = (uint32 *)memPhysMap (GAFR0_L);
+  struct physMapping pm;
+  uint32 *gafr = (uint32 *)memPhysMapRange (&pm, GAFR0_L, 6 * 4);
+  if (!gafr)
+    return -1;
 
-  return (gafr [num >> 4] >> ((num & 15) << 1)) & 3;
+  uint32 alt = (gafr [num >> 4] >> ((num & 15) << 1)) & 3;
+  memPhysUnmap (&pm);
+  return alt;
 }
 
 int gpioGetState (int num)
@@ -72,8 +90,13 @@ int gpioGetState (int num)
   if (num > 84)
     return -1;
 
-  uint32 *gplr = (uint32 *)memPhysMap (GPLR0);
-  return (gplr [num >> 5] >> (num & 31)) & 1;
+  struct physMapping pm;
+  uint32 *gplr = (uint32 *)memPhysMapRange (&pm, GPLR0, 3 * 4);
+  if (!gplr)
+    return -1;
+  int state = (gplr [num >> 5] >> (num & 31)) & 1;
+  memPhysUnmap (&pm);
+  return state;
 }
 
 void gpioSetState (int num, bool state)
@@ -81,8 +104,12 @@ void gpioSetState (int num, bool state)
   if (num > 84)
     return;
 
-  uint32 *gpscr = (uint32 *)memPhysMap (state ? GPSR0 : GPCR0);
+  struct physMapping pm;
+  uint32 *gpscr = (uint32 *)memPhysMapRange (&pm, state ? GPSR0 : GPCR0, 3 * 4);
+  if (!gpscr)
+    return;
   gpscr [num >> 5] |= 1 << (num & 31);
+  memPhysUnmap (&pm);
 }
 
 int gpioGetSleepState (int num)
@@ -90,8 +117,13 @@ int gpioGetSleepState (int num)
   if (num > 84)
     return -1;
 
-  uint32 *pgsr = (uint32 *)memPhysMap (PGSR0);
-  return (pgsr [num >> 5] >> (num & 31)) & 1;
+  struct physMapping pm;
+  uint32 *pgsr = (uint32 *)memPhysMapRange (&pm, PGSR0, 3 * 4);
+  if (!pgsr)
+    return -1;
+  int state = (pgsr [num >> 5] >> (num & 31)) & 1;
+  memPhysUnmap (&pm);
+  return state;
 }
 
 void gpioSetSleepState (int num, bool state)
@@ -99,7 +131,10 @@ void gpioSetSleepState (int num, bool state)
   if (num > 84)
     return;
 
-  uint32 *pgsr = (uint32 *)memPhysMap (PGSR0);
+  struct physMapping pm;
+  uint32 *pgsr = (uint32 *)memPhysMapRange (&pm, PGSR0, 3 * 4);
+  if (!pgsr)
+    return;
   uint32 ofs = num >> 5;
   uint32 mask = 1 << (num & 31);
 
@@ -107,6 +142,7 @@ void gpioSetSleepState (int num, bool state)
     pgsr [ofs] |= mask;
   else
     pgsr [ofs] &= ~mask;
+  memPhysUnmap (&pm);
 }
 
 // Watch for given number of seconds which GPIO pins change
@@ -122,24 +158,31 @@ static void gpioWatch (uint seconds)
   int fin_time = cur_time + seconds;
   int i, j;
 
-  uint32 *gplr = (uint32 *)memPhysMap (GPLR0);
+  // The registers stay mapped for the whole watch
+  struct physMapping gplr_pm, gpdr_pm, gafr_pm;
+  uint32 *gplr = (uint32 *)memPhysMapRange (&gplr_pm, GPLR0, 3 * 4);
+  uint32 *gpdr = (uint32 *)memPhysMapRange (&gpdr_pm, GPDR0, 3 * 4);
+  uint32 *gafr = (uint32 *)memPhysMapRange (&gafr_pm, GAFR0_L, 6 * 4);
+  if (!gplr || !gpdr || !gafr)
+  {
+    Output(C_ERROR "Unable to map GPIO registers");
+    goto out;
+  }
+
   uint32 old_gplr [3];
   for (i = 0; i < 3; i++)
     old_gplr [i] = gplr [i];
 
-  uint32 *gpdr = (uint32 *)memPhysMap (GPDR0);
   uint32 old_gpdr [3];
   for (i = 0; i < 3; i++)
     old_gpdr [i] = gpdr [i];
 
-  uint32 *gafr = (uint32 *)memPhysMap (GAFR0_L);
   uint32 old_gafr [6];
   for (i = 0; i < 6; i++)
     old_gafr [i] = gafr [i];
 
   while (cur_time <= fin_time)
   {
-    gplr = (uint32 *)memPhysMap (GPLR0);
     for (i = 0; i < 3; i++)
     {
       uint32 val = gplr [i];
@@ -156,7 +199,6 @@ static void gpioWatch (uint seconds)
       }
     }
 
-    gpdr = (uint32 *)memPhysMap (GPDR0);
     for (i = 0; i < 3; i++)
     {
       uint32 val = gpdr [i];
@@ -173,7 +215,6 @@ static void gpioWatch (uint seconds)
       }
     }
 
-    gafr = (uint32 *)memPhysMap (GAFR0_L);
     for (i = 0; i < 6; i++)
     {
       uint32 val = gafr [i];
@@ -192,6 +233,11 @@ static void gpioWatch (uint seconds)
 
     cur_time = time (NULL);
   }
+
+out:
+  memPhysUnmap (&gafr_pm);
+  memPhysUnmap (&gpdr_pm);
+  memPhysUnmap (&gplr_pm);
 }
 
 static void
@@ -270,8 +316,16 @@ static void
 gpioDump(const char *tok, const char *args)
 {
   const uint rows = 84/4;
-  uint32 *grer = (uint32 *)memPhysMap (GRER0);
-  uint32 *gfer = (uint32 *)memPhysMap (GFER0);
+  struct physMapping grer_pm, gfer_pm;
+  uint32 *grer = (uint32 *)memPhysMapRange (&grer_pm, GRER0, 3 * 4);
+  uint32 *gfer = (uint32 *)memPhysMapRange (&gfer_pm, GFER0, 3 * 4);
+  if (!grer || !gfer)
+  {
+    Output(C_ERROR "Unable to map GPIO registers");
+    memPhysUnmap (&gfer_pm);
+    memPhysUnmap (&grer_pm);
+    return;
+  }
 
   Output("GPIO# D S A INTER | GPIO# D S A INTER | GPIO# D S A INTER | GPIO# D S A INTER");
   Output("------------------+-------------------+-------------------+------------------");
@@ -289,6 +343,8 @@ gpioDump(const char *tok, const char *args)
            j < 3 ? " | \t" : "");
     }
   }
+  memPhysUnmap (&gfer_pm);
+  memPhysUnmap (&grer_pm);
 }
 REG_DUMP(testPXA, "GPIO", gpioDump,
          "GPIO\n"
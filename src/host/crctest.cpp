@@ -0,0 +1,65 @@
+/*
+ * Host test of the table driven CRC32 used by the preloader.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+// Run with "make crctest".  The results are compared against the
+// original bit at a time implementation.
+
+#include <stdio.h> // printf
+#include <stdlib.h> // rand
+
+#include "crc32.h"
+
+static uint32
+bitwise_crc32_be(uint32 crc, const char *data, uint32 len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    int i;
+    while (len--) {
+        crc ^= *p++ << 24;
+        for (i = 0; i < 8; i++)
+            crc = (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+    }
+    return crc;
+}
+
+static uint32
+bitwise_crc32_be_finish(uint32 crc, uint32 len)
+{
+    for (; len; len >>= 8) {
+        unsigned char l = len;
+        crc = bitwise_crc32_be(crc, (char *)&l, 1);
+    }
+    return ~crc & 0xFFFFFFFF;
+}
+
+int
+main()
+{
+    static char buf[3 * 4096 + 17];
+    uint32 table[CRC32_TABLE_SIZE];
+    crc32_be_init(table);
+    for (uint32 i = 0; i < sizeof(buf); i++)
+        buf[i] = rand();
+
+    int fails = 0;
+    for (int t = 0; t < 1000; t++) {
+        uint32 len = t ? rand() % sizeof(buf) : 0;
+        uint32 split = len ? rand() % len : 0;
+        // Checksum in two parts, as crc_pages does per page.
+        uint32 crc = crc32_be(table, 0, buf, split);
+        crc = crc32_be(table, crc, buf + split, len - split);
+        crc = crc32_be_finish(table, crc, len);
+        uint32 ref = bitwise_crc32_be(0, buf, len);
+        ref = bitwise_crc32_be_finish(ref, len);
+        if (crc != ref) {
+            printf("FAIL: len=%u split=%u crc=%08x expected %08x\n"
+                   , len, split, crc, ref);
+            fails++;
+        }
+    }
+    printf("crc32 test %s\n", fails ? "FAILED" : "passed");
+    return fails != 0;
+}
@@ -0,0 +1,435 @@
+/* Host tool to analyze the mmu maps written by DUMP MMUMAP.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+// Build with "make mmumap".  Maps in either the binary or the csv
+// format are accepted.
+
+#include <stdio.h> // printf, fopen
+#include <stdlib.h> // strtoul, realloc
+#include <string.h> // memcmp
+
+#include "xtypes.h"
+#include "memory.h" // MMU_L1_*, MMU_L2_*
+#include "mmumap.h"
+
+// WinCE gives each process a 32MB slot in the low 2GB.
+#define SLOT_SHIFT 25
+#define SLOT_COUNT 64
+
+struct mmuMap {
+    const char *name;
+    uint32 arch;
+    uint32 count, max;
+    struct mmuMapRecord *recs;
+};
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage:\n"
+            "  mmumap show <map>...\n"
+            "  mmumap who <paddr> <size> <map>...\n"
+            "  mmumap diff <old-map> <new-map>\n"
+            "  mmumap coverage <map>...\n");
+    exit(1);
+}
+
+static int
+addRecord(struct mmuMap *m, const struct mmuMapRecord *r)
+{
+    if (m->count == m->max) {
+        m->max = m->max ? m->max * 2 : 256;
+        m->recs = (struct mmuMapRecord *)realloc(m->recs
+                                                 , m->max * sizeof(*r));
+        if (!m->recs)
+            return -1;
+    }
+    m->recs[m->count++] = *r;
+    return 0;
+}
+
+// Csv maps don't have a header - the arch flags are guessed from the
+// type names.
+static int
+loadCSV(struct mmuMap *m, FILE *f)
+{
+    char line[256], type[64];
+    if (!fgets(line, sizeof(line), f))
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        struct mmuMapRecord r;
+        if (sscanf(line, "%x,%x,%x,%63[^,],%u,%x,%u", &r.vaddr, &r.paddr
+                   , &r.size, type, &r.level, &r.flags, &r.domain) != 7) {
+            fprintf(stderr, "%s: bad line: %s", m->name, line);
+            return -1;
+        }
+        if (!strcmp(type, "16MB section") || !strcmp(type, "Extended (4K)"))
+            m->arch |= MMUMAP_ARM6MMU;
+        if (addRecord(m, &r))
+            return -1;
+    }
+    return 0;
+}
+
+static int
+cmpRecord(const void *a, const void *b)
+{
+    uint32 x = ((const struct mmuMapRecord *)a)->vaddr;
+    uint32 y = ((const struct mmuMapRecord *)b)->vaddr;
+    return x < y ? -1 : x > y;
+}
+
+static int
+loadMap(struct mmuMap *m, const char *name)
+{
+    memset(m, 0, sizeof(*m));
+    m->name = name;
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        perror(name);
+        return -1;
+    }
+    struct mmuMapHeader h;
+    int ret = 0;
+    if (fread(&h, sizeof(h), 1, f) != 1
+        || memcmp(h.magic, MMUMAP_MAGIC, sizeof(h.magic))) {
+        rewind(f);
+        ret = loadCSV(m, f);
+    } else {
+        m->arch = h.arch;
+        struct mmuMapRecord r;
+        while (!ret && fread(&r, sizeof(r), 1, f) == 1)
+            ret = addRecord(m, &r);
+    }
+    fclose(f);
+    if (ret)
+        fprintf(stderr, "%s: unable to load map\n", name);
+    else if (m->count)
+        // Hand edited csv files may not be in order.
+        qsort(m->recs, m->count, sizeof(m->recs[0]), cmpRecord);
+    return ret;
+}
+
+
+/****************************************************************
+ * Descriptor decoding (as done by haret's DUMP MMU)
+ ****************************************************************/
+
+static char *
+flagsCB(char *p, uint32 &d)
+{
+    *p++ = ' ';
+    *p++ = (d & MMU_L1_CACHEABLE) ? 'C' : ' ';
+    *p++ = (d & MMU_L1_BUFFERABLE) ? 'B' : ' ';
+    d &= ~(MMU_L1_CACHEABLE|MMU_L1_BUFFERABLE);
+    return p;
+}
+
+static char *
+flagsCond(char *p, uint32 &d, uint32 bits, uint32 shift, const char *name)
+{
+    uint32 mask = ((1<<bits) - 1) << shift;
+    if (!(d & mask))
+        return p;
+    if (bits > 1)
+        p += sprintf(p, " %s=%x", name, (d&mask) >> shift);
+    else
+        p += sprintf(p, " %s", name);
+    d &= ~mask;
+    return p;
+}
+
+static char *
+flagsAP(char *p, uint32 &d, uint32 arch, uint32 count, int shift
+        , int apxbit = 0)
+{
+    uint32 add = 0;
+    if ((arch & MMUMAP_NOSUBPAGES) && (d & (1<<apxbit))) {
+        d &= ~(1<<apxbit);
+        add = 4;
+    }
+    p += sprintf(p, " AP=");
+    for (uint32 i = 0; i < count; i++) {
+        *p++ = '0' + ((d>>shift) & 3) + add;
+        d &= ~(3<<shift);
+        shift += 2;
+    }
+    return p;
+}
+
+static void
+flagsOther(char *p, uint32 d)
+{
+    d &= ~MMU_L1_TYPE_MASK;
+    if (d)
+        p += sprintf(p, " ?=%x", d);
+    *p = 0;
+}
+
+// Fill in the type name and flag description of a record.
+static const char *
+describe(const struct mmuMapRecord *r, uint32 arch, char *p)
+{
+    uint32 d = r->flags, type = d & 3;
+    int arm6 = arch & MMUMAP_ARM6MMU, nosub = arch & MMUMAP_NOSUBPAGES;
+    const char *name;
+    p = flagsCB(p, d);
+    if (r->level == 1) {
+        int super = arm6 && (d & MMU_L1_SUPER_SECTION_FLAG);
+        name = super ? "16MB section" : "1MB section";
+        p = flagsAP(p, d, arch, 1, MMU_L1_AP_SHIFT, 15);
+        if (!super)
+            p = flagsCond(p, d, 4, 5, "D");
+        if (arm6) {
+            d &= ~MMU_L1_SUPER_SECTION_FLAG;
+            p = flagsCond(p, d, 1, 9, "P");
+            p = flagsCond(p, d, 3, 12, "T");
+            if (nosub) {
+                p = flagsCond(p, d, 1, 17, "nG");
+                p = flagsCond(p, d, 1, 16, "S");
+                p = flagsCond(p, d, 1, 4, "XN");
+            }
+        }
+    } else if (arm6 && ((nosub && (type & 2)) || type == 3)) {
+        name = "Extended (4K)";
+        p = flagsAP(p, d, arch, 1, MMU_L2_AP0_SHIFT, 9);
+        p = flagsCond(p, d, 3, 6, "T");
+        if (nosub) {
+            p = flagsCond(p, d, 1, 11, "nG");
+            p = flagsCond(p, d, 1, 10, "S");
+            p = flagsCond(p, d, 1, 0, "XN");
+        }
+    } else if (type == MMU_L2_LARGEPAGE) {
+        name = "Large (64K)";
+        if (arm6) {
+            p = flagsCond(p, d, 3, 12, "T");
+            if (nosub) {
+                p = flagsAP(p, d, arch, 1, MMU_L2_AP0_SHIFT, 9);
+                p = flagsCond(p, d, 1, 11, "nG");
+                p = flagsCond(p, d, 1, 10, "S");
+                p = flagsCond(p, d, 1, 15, "XN");
+            } else {
+                p = flagsAP(p, d, arch, 4, MMU_L2_AP0_SHIFT);
+            }
+        } else {
+            p = flagsAP(p, d, arch, 4, MMU_L2_AP0_SHIFT);
+        }
+    } else if (type == MMU_L2_SMALLPAGE) {
+        name = "Small (4K)";
+        p = flagsAP(p, d, arch, 4, MMU_L2_AP0_SHIFT);
+    } else {
+        name = "Tiny (1K)";
+        p = flagsAP(p, d, arch, 1, MMU_L2_AP0_SHIFT);
+    }
+    flagsOther(p, d);
+    return name;
+}
+
+static void
+printRecord(const char *prefix, const struct mmuMapRecord *r, uint32 arch)
+{
+    char flags[128];
+    const char *name = describe(r, arch, flags);
+    printf("%s%08x-%08x | %08x | %13s | D=%-2d|%s\n", prefix
+           , r->vaddr, r->vaddr + r->size - 1, r->paddr, name
+           , r->domain, flags);
+}
+
+
+/****************************************************************
+ * Commands
+ ****************************************************************/
+
+static void
+cmdShow(struct mmuMap *m)
+{
+    printf("%s: %d ranges\n", m->name, m->count);
+    for (uint32 i = 0; i < m->count; i++)
+        printRecord("", &m->recs[i], m->arch);
+}
+
+// Show all the virtual ranges that map part of a physical range.
+static void
+cmdWho(struct mmuMap *m, uint32 paddr, uint32 size)
+{
+    uint64 pend = (uint64)paddr + size;
+    for (uint32 i = 0; i < m->count; i++) {
+        struct mmuMapRecord r = m->recs[i];
+        uint64 rend = (uint64)r.paddr + r.size;
+        if (rend <= paddr || r.paddr >= pend)
+            continue;
+        // Trim the range to the requested part.
+        if (r.paddr < paddr) {
+            r.vaddr += paddr - r.paddr;
+            r.size -= paddr - r.paddr;
+            r.paddr = paddr;
+        }
+        if (rend > pend)
+            r.size -= rend - pend;
+        printf("%s: ", m->name);
+        printRecord("", &r, m->arch);
+    }
+}
+
+// Find the record that maps 'vaddr' (or NULL).
+static struct mmuMapRecord *
+findRecord(struct mmuMap *m, uint32 vaddr)
+{
+    uint32 lo = 0, hi = m->count;
+    while (lo < hi) {
+        uint32 mid = (lo + hi) / 2;
+        struct mmuMapRecord *r = &m->recs[mid];
+        if (vaddr < r->vaddr)
+            hi = mid;
+        else if ((uint64)vaddr >= (uint64)r->vaddr + r->size)
+            lo = mid + 1;
+        else
+            return r;
+    }
+    return NULL;
+}
+
+static int
+cmpU64(const void *a, const void *b)
+{
+    uint64 x = *(const uint64 *)a, y = *(const uint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Report the virtual ranges that are mapped differently.
+static void
+cmdDiff(struct mmuMap *o, struct mmuMap *n)
+{
+    // Every range boundary of either map starts a new segment.
+    uint32 count = 0;
+    uint64 *bounds = (uint64 *)malloc((o->count + n->count) * 2 * 8 + 16);
+    if (!bounds)
+        return;
+    struct mmuMap *maps[2] = { o, n };
+    for (int m = 0; m < 2; m++)
+        for (uint32 i = 0; i < maps[m]->count; i++) {
+            bounds[count++] = maps[m]->recs[i].vaddr;
+            bounds[count++] = (uint64)maps[m]->recs[i].vaddr
+                + maps[m]->recs[i].size;
+        }
+    qsort(bounds, count, sizeof(bounds[0]), cmpU64);
+
+    uint32 changes = 0;
+    for (uint32 i = 0; i + 1 < count; i++) {
+        if (bounds[i] == bounds[i+1])
+            continue;
+        uint32 start = bounds[i];
+        struct mmuMapRecord *ro = findRecord(o, start);
+        struct mmuMapRecord *rn = findRecord(n, start);
+        if (!ro && !rn)
+            continue;
+        struct mmuMapRecord so, sn;
+        if (ro) {
+            so = *ro;
+            so.paddr += start - so.vaddr;
+            so.vaddr = start;
+            so.size = bounds[i+1] - start;
+        }
+        if (rn) {
+            sn = *rn;
+            sn.paddr += start - sn.vaddr;
+            sn.vaddr = start;
+            sn.size = bounds[i+1] - start;
+        }
+        if (ro && rn && so.paddr == sn.paddr && so.level == sn.level
+            && so.flags == sn.flags && so.domain == sn.domain)
+            continue;
+        changes++;
+        if (ro)
+            printRecord("- ", &so, o->arch);
+        if (rn)
+            printRecord("+ ", &sn, n->arch);
+    }
+    printf("%d changed ranges\n", changes);
+    free(bounds);
+}
+
+// Show how much of each process slot (and the kernel space) is mapped.
+static void
+cmdCoverage(struct mmuMap *m)
+{
+    uint64 slotBytes[SLOT_COUNT + 1];
+    uint32 slotRanges[SLOT_COUNT + 1];
+    memset(slotBytes, 0, sizeof(slotBytes));
+    memset(slotRanges, 0, sizeof(slotRanges));
+    for (uint32 i = 0; i < m->count; i++) {
+        struct mmuMapRecord *r = &m->recs[i];
+        uint64 pos = r->vaddr, end = pos + r->size;
+        while (pos < end) {
+            uint32 slot = pos >> SLOT_SHIFT;
+            uint64 next = (uint64)(slot + 1) << SLOT_SHIFT;
+            if (slot >= SLOT_COUNT) {
+                slot = SLOT_COUNT;
+                next = end;
+            }
+            if (next > end)
+                next = end;
+            slotBytes[slot] += next - pos;
+            slotRanges[slot]++;
+            pos = next;
+        }
+    }
+    printf("%s:\n Slot | Address  |   Mapped | Ranges\n", m->name);
+    for (uint32 s = 0; s <= SLOT_COUNT; s++) {
+        if (!slotRanges[s])
+            continue;
+        if (s < SLOT_COUNT)
+            printf("  %3d | %08x | %7lluK | %d\n", s, s << SLOT_SHIFT
+                   , (unsigned long long)slotBytes[s] / 1024, slotRanges[s]);
+        else
+            printf(" kern | %08x | %7lluK | %d\n", SLOT_COUNT << SLOT_SHIFT
+                   , (unsigned long long)slotBytes[s] / 1024, slotRanges[s]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3)
+        usage();
+    const char *cmd = argv[1];
+    int first = 2;
+    uint32 paddr = 0, size = 0;
+    if (!strcmp(cmd, "who")) {
+        if (argc < 5)
+            usage();
+        paddr = strtoul(argv[2], NULL, 0);
+        size = strtoul(argv[3], NULL, 0);
+        first = 4;
+    } else if (!strcmp(cmd, "diff")) {
+        if (argc != 4)
+            usage();
+    } else if (strcmp(cmd, "show") && strcmp(cmd, "coverage")) {
+        usage();
+    }
+
+    int count = argc - first;
+    struct mmuMap *maps = (struct mmuMap *)calloc(count, sizeof(*maps));
+    if (!maps)
+        return 1;
+    for (int i = 0; i < count; i++)
+        if (loadMap(&maps[i], argv[first + i]))
+            return 1;
+
+    if (!strcmp(cmd, "diff")) {
+        cmdDiff(&maps[0], &maps[1]);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(cmd, "show"))
+            cmdShow(&maps[i]);
+        else if (!strcmp(cmd, "who"))
+            cmdWho(&maps[i], paddr, size);
+        else
+            cmdCoverage(&maps[i]);
+    }
+    return 0;
+}
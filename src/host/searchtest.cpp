@@ -0,0 +1,247 @@
+/*
+ * Host test of the [P|V]SEARCH engine against simulated memory.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+// Run with "make searchtest".  Patterns are planted in the simulated
+// RAM, and the matches found a block at a time (physically, and
+// virtually through the simulated L1/L2 tables) are compared against a
+// plain byte by byte scan.
+
+#include <stdio.h> // printf
+#include <stdlib.h> // rand
+#include <string.h> // memcpy
+
+#include "xtypes.h"
+#include "cpu.h" // PAGE_SIZE
+#include "memory.h" // MMU_L1_*, MMU_L2_*
+#include "physbackend.h"
+#include "physsim.h"
+#include "memsearch.h"
+
+#define RAM_ADDR 0xa0000000
+#define RAM_SIZE 0x400000
+// Area of RAM that is searched
+#define AREA_SIZE 0x100000
+
+#define MAX_HITS 256
+
+static uint32 Hits[MAX_HITS];
+
+static void
+testHit(struct searchPattern *sp, uint32 addr)
+{
+    if (sp->count < MAX_HITS)
+        Hits[sp->count] = addr;
+    sp->count++;
+}
+
+// Read simulated physical memory through the backend - every call
+// gets its own window, like memPhysReadBlock with a cold cache.
+static uint32
+physRead(void *dst, uint32 paddr, uint32 len)
+{
+    uint32 base = paddr & ~(PAGE_SIZE - 1);
+    uint32 size = PAGE_ALIGN(paddr + len) - base;
+    uint8 *virt = PhysBackend->mapPhys(base, size, 0);
+    if (!virt)
+        return 0;
+    memcpy(dst, virt + (paddr - base), len);
+    PhysBackend->unmapPhys(virt, size);
+    return len;
+}
+
+static void
+physWrite(uint32 paddr, const void *src, uint32 len)
+{
+    uint32 base = paddr & ~(PAGE_SIZE - 1);
+    uint32 size = PAGE_ALIGN(paddr + len) - base;
+    uint8 *virt = PhysBackend->mapPhys(base, size, 0);
+    if (!virt) {
+        printf("Unable to map %08x\n", paddr);
+        exit(1);
+    }
+    memcpy(virt + (paddr - base), src, len);
+    PhysBackend->unmapPhys(virt, size);
+}
+
+static uint32
+physRead32(uint32 paddr)
+{
+    uint32 val = 0;
+    physRead(&val, paddr, 4);
+    return val;
+}
+
+// Translate a virtual address with the simulated mmu tables.
+static uint32
+simVirtToPhys(uint32 vaddr)
+{
+    uint32 l1d = physRead32(PhysBackend->mmuBase() + (vaddr >> 20) * 4);
+    switch (l1d & MMU_L1_TYPE_MASK) {
+    case MMU_L1_SECTION:
+        return (l1d & MMU_L1_SECTION_MASK) | (vaddr & ~MMU_L1_SECTION_MASK);
+    case MMU_L1_COARSE_L2: {
+        uint32 l2d = physRead32((l1d & MMU_L1_COARSE_MASK)
+                                + ((vaddr >> 12) & 0xff) * 4);
+        if ((l2d & MMU_L2_TYPE_MASK) != MMU_L2_SMALLPAGE)
+            return (uint32)-1;
+        return (l2d & MMU_L2_SMALL_MASK) | (vaddr & ~MMU_L2_SMALL_MASK);
+    }
+    }
+    return (uint32)-1;
+}
+
+// Read simulated virtual memory a page at a time.
+static uint32
+virtRead(void *dst, uint32 vaddr, uint32 len)
+{
+    uint32 done = 0;
+    while (done < len) {
+        uint32 sz = PAGE_SIZE - ((vaddr + done) & (PAGE_SIZE - 1));
+        if (sz > len - done)
+            sz = len - done;
+        uint32 paddr = simVirtToPhys(vaddr + done);
+        if (paddr == (uint32)-1 || physRead((uint8*)dst + done, paddr, sz) != sz)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+// Find the matches in 'mem' the slow way.
+static uint32
+refSearch(struct searchPattern *sp, const uint8 *mem, uint32 size
+          , uint32 base, uint32 *hits)
+{
+    uint32 count = 0;
+    uint32 step = sp->isWord ? 4 : 1;
+    for (uint32 pos = 0; pos + sp->len <= size; pos += step) {
+        uint32 j;
+        if (sp->isWord) {
+            const uint32 *w = (const uint32 *)&mem[pos];
+            for (j = 0; j < sp->len / 4; j++)
+                if ((w[j] & sp->masks[j]) != sp->words[j])
+                    break;
+            if (j < sp->len / 4)
+                continue;
+        } else if (memcmp(&mem[pos], sp->bytes, sp->len)) {
+            continue;
+        }
+        if (count < MAX_HITS)
+            hits[count] = base + pos;
+        count++;
+    }
+    return count;
+}
+
+static int
+check(const char *name, struct searchPattern *sp, uint32 start
+      , searchReadFunc read, uint32 bufsize, uint32 minHits)
+{
+    static uint8 mem[AREA_SIZE], buf[0x10000];
+    static uint32 ref[MAX_HITS];
+    if (read(mem, start, AREA_SIZE) != AREA_SIZE) {
+        printf("%s: unable to read %08x\n", name, start);
+        return 1;
+    }
+    uint32 refCount = refSearch(sp, mem, AREA_SIZE, start, ref);
+
+    sp->hit = testHit;
+    uint32 done = searchRange(sp, start, AREA_SIZE, buf, bufsize, read);
+    int fails = 0;
+    if (done != AREA_SIZE) {
+        printf("%s: searched %08x of %08x bytes\n", name, done, AREA_SIZE);
+        fails++;
+    }
+    if (sp->count != refCount || sp->count < minHits) {
+        printf("%s: %d matches - expected %d (at least %d)\n"
+               , name, sp->count, refCount, minHits);
+        fails++;
+    }
+    for (uint32 i = 0; i < sp->count && i < refCount && i < MAX_HITS; i++)
+        if (Hits[i] != ref[i]) {
+            printf("%s: match %d at %08x - expected %08x\n"
+                   , name, i, Hits[i], ref[i]);
+            fails++;
+            break;
+        }
+    return fails;
+}
+
+int
+main()
+{
+    if (physSimInit(RAM_ADDR, RAM_SIZE))
+        return 1;
+    physSimBuildMMU();
+
+    // Random contents, with a few patterns planted at block
+    // boundaries (searches below use 256 and 4096 byte blocks).
+    static uint8 mem[AREA_SIZE];
+    srand(1);
+    for (uint32 i = 0; i < AREA_SIZE; i++)
+        mem[i] = rand();
+    static const uint32 words[] = { 0x12345678, 0x9abcdef0, 0x0badf00d };
+    static const uint32 wordOffs[] = { 0x40, 0xf8, 0xffc, 0x1ff8, 0x54320
+                                       , AREA_SIZE - 0x100 };
+    for (uint32 i = 0; i < ARRAY_SIZE(wordOffs); i++)
+        memcpy(&mem[wordOffs[i]], words, sizeof(words));
+    static const char str[] = "HaRET search test";
+    static const uint32 strOffs[] = { 0x21, 0x1fe, 0x2ff7, 0x3ffd, 0x7fffe
+                                      , 0xa0001 };
+    for (uint32 i = 0; i < ARRAY_SIZE(strOffs); i++)
+        memcpy(&mem[strOffs[i]], str, sizeof(str) - 1);
+    // A string split between the end and the start of the area - the
+    // L2 table swaps the halves, so virtually it is continuous.
+    memcpy(&mem[AREA_SIZE - 5], str, 5);
+    memcpy(&mem[0], str + 5, sizeof(str) - 1 - 5);
+    physWrite(RAM_ADDR, mem, AREA_SIZE);
+
+    int fails = 0;
+    struct searchPattern sp;
+    uint32 sizes[] = { 256, 4096 };
+    for (uint32 s = 0; s < ARRAY_SIZE(sizes); s++) {
+        memset(&sp, 0, sizeof(sp));
+        sp.isWord = 1;
+        sp.len = sizeof(words);
+        for (uint32 i = 0; i < ARRAY_SIZE(words); i++) {
+            sp.words[i] = words[i];
+            sp.masks[i] = 0xffffffff;
+        }
+        fails += check("words", &sp, RAM_ADDR, physRead, sizes[s]
+                       , ARRAY_SIZE(wordOffs));
+
+        // Mask out the low byte of the first word.
+        sp.masks[0] = 0xffffff00;
+        sp.words[0] &= sp.masks[0];
+        fails += check("masked words", &sp, RAM_ADDR, physRead, sizes[s]
+                       , ARRAY_SIZE(wordOffs));
+
+        memset(&sp, 0, sizeof(sp));
+        sp.isWord = 1;
+        sp.len = 4;
+        sp.words[0] = 0x0000f00d;
+        sp.masks[0] = 0x0000ffff;
+        fails += check("single word", &sp, RAM_ADDR, physRead, sizes[s]
+                       , ARRAY_SIZE(wordOffs));
+
+        memset(&sp, 0, sizeof(sp));
+        sp.len = sizeof(str) - 1;
+        memcpy(sp.bytes, str, sp.len);
+        fails += check("string", &sp, RAM_ADDR, physRead, sizes[s]
+                       , ARRAY_SIZE(strOffs));
+        // Virtually, the copy at 0x7fffe is split instead.
+        fails += check("virtual string", &sp, 0xc0000000, virtRead, sizes[s]
+                       , ARRAY_SIZE(strOffs));
+    }
+
+    physSimDone();
+    if (fails) {
+        printf("search test failed\n");
+        return 1;
+    }
+    printf("search test passed\n");
+    return 0;
+}
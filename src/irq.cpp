@@ -13,7 +13,7 @@
 #include "xtypes.h"
 #include "watch.h" // memcheck
 #include "output.h" // Output
-#include "memory.h" // memVirtToPhys
+#include "memory.h" // memVirtToPhys, memVirtToPhysFlush
 #include "script.h" // REG_CMD
 #include "machines.h" // Mach
 #include "lateload.h" // LATE_LOAD
@@ -445,6 +445,8 @@ cmd_wirq(const char *cmd, const char *args)
     *abort_loc = newAbortHandler;
     *prefetch_loc = newPrefetchHandler;
     return_control();
+    // The l1 traps changed the mmu table
+    memVirtToPhysFlush();
     Output("Finished installing exception handlers.");
 
     // Loop till time up.
@@ -461,6 +463,8 @@ cmd_wirq(const char *cmd, const char *args)
     *abort_loc = asmVars->winceAbortHandler;
     *prefetch_loc = asmVars->wincePrefetchHandler;
     return_control();
+    // The l1 traps changed the mmu table
+    memVirtToPhysFlush();
     Output("Finished restoring windows exception handlers.");
 
     unhookResume();
@@ -468,6 +472,8 @@ cmd_wirq(const char *cmd, const char *args)
     dumpMMUMerge(data);
     postLoop(data);
 abort:
+    if (code)
+        memPhysUnmap(&data->mmuMap);
     freeContPages(pageinfo);
 }
 REG_CMD(0, "WI|RQ", cmd_wirq,
@@ -573,7 +573,8 @@ prepL1traps(struct irqData *data)
         return -1;
     }
 
-    data->mmuVAddr = (uint32*)memPhysMap(cpuGetMMU());
+    data->mmuVAddr = (uint32*)memPhysMapRange(&data->mmuMap, cpuGetMMU()
+                                              , 4096 * 4);
     if (! data->mmuVAddr) {
         Output("Unable to map MMU table");
         return -1;
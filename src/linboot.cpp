@@ -16,7 +16,7 @@
 
 #include "xtypes.h"
 #include "script.h" // REG_CMD
-#include "memory.h" // memPhysMap, memPhysAddr, memPhysSize
+#include "memory.h" // memPhysMapRange, memPhysAddr, memPhysSize
 #include "output.h" // Output, Screen, fnprepare
 #include "cpu.h" // take_control, return_control
 #include "video.h" // vidGetVRAM
@@ -24,6 +24,7 @@
 #include "fbwrite.h" // fb_puts
 #include "winvectors.h" // stackJumper_s
 #include "linboot.h"
+#include "crc32.h" // crc32_be
 #include "resource.h"
 
 // Kernel file name
@@ -56,6 +57,20 @@ REG_VAR_INT(0, "TAGS_OFFSET", tagsOffset, "Tags offset from physical ram start"
 REG_VAR_INT(0, "KERNEL_OFFSET", kernelOffset, "Kernel offset from physical ram start")
 REG_VAR_INT(0, "INITRD_OFFSET", initrdOffset, "Initrd offset from physical ram start")
 
+static uint32 KernelCRC;
+REG_VAR_INT(0, "KERNELCRC", KernelCRC
+            , "If set, perform a CRC check on the kernel/initrd.")
+// Extra pages allocated in the hope they are at a kernel/initrd
+// destination already (and thus need not be relocated).  Off by
+// default - the pages are held until boot, which small devices may
+// not be able to spare.
+static uint32 bootSparePages = 0;
+REG_VAR_INT(0, "BOOTSPARE", bootSparePages
+            , "Extra pages to allocate at boot so that more kernel/initrd"
+            " pages are already in place and needn't be relocated (each"
+            " page is 4K of RAM held until boot - 0 to disable, eg 512"
+            " saves copying on devices with RAM to spare)")
+
 /*
  * Theory of operation:
  *
@@ -81,11 +96,14 @@ REG_VAR_INT(0, "INITRD_OFFSET", initrdOffset, "Initrd offset from physical ram s
  * can find the proper pages when the mmu is off.  This is complicated
  * because the list itself is built while CE is running (it is
  * allocated in virtual memory) and it can exceed one page in size.
- * To handle this, the system uses a "three level page list" - a list
+ * To handle this, the system uses a "multi level page list" - a page
  * of pointers to pages which contain pointers to pages.  The
  * preloader is passed in a data structure which can not exceed one
- * page (see preloadData).  This structure has a list of pointers to
- * pages (indexPages) that contain pointers to pages of the kernel.
+ * page (see preloadData).  This structure has a pointer to a
+ * directory page (indexDir) that holds pointers to the index pages,
+ * which in turn contain pointers to pages of the kernel.  One
+ * directory page covers 4GB of kernel/initrd, so the image size is
+ * only limited by the ram available.
  *
  * Because the preloader and hardware shutdown can be complicated, the
  * code will try to write status messages directly to the framebuffer.
@@ -146,8 +164,8 @@ setup_linux_params(char *tagaddr, uint32 phys_initrd_addr, uint32 initrd_size)
  * Preloader
  ****************************************************************/
 
-// Maximum number of index pages.
-#define MAX_INDEX 6
+// Number of page pointers in an index page (and of index page
+// pointers in the directory page).
 #define PAGES_PER_INDEX (PAGE_SIZE / sizeof(uint32))
 
 // Data Shared between normal haret code and C preload code.
@@ -164,7 +182,7 @@ struct preloadData {
     uint32 kernelSize;
     uint32 initrdOffset;
     uint32 initrdSize;
-    const char **indexPages[MAX_INDEX];
+    const char ***indexDir;
 
     // Optional CRC check
     uint32 doCRC;
@@ -179,47 +197,47 @@ struct preloadData {
     startfunc_t machStartFunc;
 };
 
-// CRC a block of ram (from linux/lib/crc32.c)
-#define CRCPOLY_BE 0x04c11db7
-static uint32 __preload
-crc32_be(uint32 crc, const char *data, uint32 len)
-{
-    const unsigned char *p = (const unsigned char *)data;
-    int i;
-    while (len--) {
-        crc ^= *p++ << 24;
-        for (i = 0; i < 8; i++)
-            crc = (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
-    }
-    return crc;
-}
-static uint32 __preload
-crc32_be_finish(uint32 crc, uint32 len)
-{
-    for (; len; len >>= 8) {
-        unsigned char l = len;
-        crc = crc32_be(crc, (char *)&l, 1);
-    }
-    return ~crc & 0xFFFFFFFF;
-}
-
-// Copy memory (need a memcpy with __preload tag).
+// Copy memory (need a memcpy with __preload tag).  Both pointers
+// must be word aligned; the count is rounded up to whole words.  The
+// bulk is moved with eight register bursts, which matters as this
+// often runs with the caches off.  It only uses a relative branch,
+// so it works wherever the preloader is copied to.
 void __preload
 do_copy(char *dest, const char *src, int count)
 {
-    uint32 *d = (uint32*)dest, *s = (uint32*)src, *e = (uint32*)&src[count];
-    while (s < e)
+    if (count <= 0)
+        return;
+    uint32 *d = (uint32*)dest, *s = (uint32*)src;
+    uint32 words = (count + 3) / 4;
+    uint32 bursts = words / 8;
+    if (bursts)
+        asm volatile("1:\n"
+                     "ldmia %1!, {r3-r8, r12, lr}\n"
+                     "stmia %0!, {r3-r8, r12, lr}\n"
+                     "subs %2, %2, #1\n"
+                     "bne 1b"
+                     : "+r" (d), "+r" (s), "+r" (bursts)
+                     : : "r3", "r4", "r5", "r6", "r7", "r8", "r12", "lr"
+                       , "cc", "memory");
+    for (words &= 7; words; words--)
         *d++ = *s++;
 }
 
-// Copy a list of pages to a linear area of memory
-static void __preload
+// Copy a list of pages to a linear area of memory.  Pages already at
+// their destination are skipped.  Returns the number of pages copied.
+static int __preload
 do_copyPages(char *dest, const char ***pages, int start, int pagecount)
 {
+    int copied = 0;
     for (int i=start; i<start+pagecount; i++) {
-        do_copy(dest, pages[i/PAGES_PER_INDEX][i%PAGES_PER_INDEX], PAGE_SIZE);
+        const char *src = pages[i/PAGES_PER_INDEX][i%PAGES_PER_INDEX];
+        if (src != dest) {
+            do_copy(dest, src, PAGE_SIZE);
+            copied++;
+        }
         dest += PAGE_SIZE;
     }
+    return copied;
 }
 
 // Get Program Status Register value (in __preload section)
@@ -285,32 +303,37 @@ preloader(struct preloadData *data)
     // Copy kernel image
     char *destKernel = (char *)data->startRam + data->kernelOffset;
     int kernelCount = PAGE_ALIGN(data->kernelSize) / PAGE_SIZE;
-    do_copyPages((char *)destKernel, data->indexPages, 0, kernelCount);
+    int copied = do_copyPages((char *)destKernel, data->indexDir
+                              , 0, kernelCount);
 
-    FB_PRINTF(&data->fbi, "Kernel relocated to 0x%%x (size 0x%%x)\\n",
-        destKernel, data->kernelSize);
+    FB_PRINTF(&data->fbi, "Kernel relocated to 0x%%x (size 0x%%x, %%d pages copied)\\n",
+        destKernel, data->kernelSize, copied);
 
     // Copy initrd (if applicable)
     char *destInitrd = (char *)data->startRam + data->initrdOffset;
     int initrdCount = PAGE_ALIGN(data->initrdSize) / PAGE_SIZE;
-    do_copyPages(destInitrd, data->indexPages, kernelCount, initrdCount);
+    copied = do_copyPages(destInitrd, data->indexDir
+                          , kernelCount, initrdCount);
 
-    FB_PRINTF(&data->fbi, "Initrd relocated to 0x%%x (size 0x%%x)\\n",
-        destInitrd, data->initrdSize);
+    FB_PRINTF(&data->fbi, "Initrd relocated to 0x%%x (size 0x%%x, %%d pages copied)\\n",
+        destInitrd, data->initrdSize, copied);
 
     // Do CRC check (if enabled).
     if (data->doCRC) {
+        uint32 crctable[CRC32_TABLE_SIZE];
+        crc32_be_init(crctable);
+
         FB_PRINTF(&data->fbi, "Checking tags crc...");
-        uint32 crc = crc32_be(0, destTags, data->tagsSize);
-        crc = crc32_be_finish(crc, data->tagsSize);
+        uint32 crc = crc32_be(crctable, 0, destTags, data->tagsSize);
+        crc = crc32_be_finish(crctable, crc, data->tagsSize);
         if (crc == data->tagsCRC)
             FB_PRINTF(&data->fbi, "okay\\n");
         else
             FB_PRINTF(&data->fbi, "FAIL FAIL FAIL\\n");
 
         FB_PRINTF(&data->fbi, "Checking kernel crc...");
-        crc = crc32_be(0, destKernel, data->kernelSize);
-        crc = crc32_be_finish(crc, data->kernelSize);
+        crc = crc32_be(crctable, 0, destKernel, data->kernelSize);
+        crc = crc32_be_finish(crctable, crc, data->kernelSize);
         if (crc == data->kernelCRC)
             FB_PRINTF(&data->fbi, "okay\\n");
         else
@@ -318,8 +341,8 @@ preloader(struct preloadData *data)
 
         if (data->initrdSize) {
             FB_PRINTF(&data->fbi, "Checking initrd crc...");
-            crc = crc32_be(0, destInitrd, data->initrdSize);
-            crc = crc32_be_finish(crc, data->initrdSize);
+            crc = crc32_be(crctable, 0, destInitrd, data->initrdSize);
+            crc = crc32_be_finish(crctable, crc, data->initrdSize);
             if (crc == data->initrdCRC)
                 FB_PRINTF(&data->fbi, "okay\\n");
             else
@@ -358,13 +381,16 @@ extern "C" {
 
 // Description of memory alocated by prepForKernel()
 struct bootmem {
-    char *imagePages[PAGES_PER_INDEX * MAX_INDEX];
+    char **imagePages;
     char **kernelPages, **initrdPages;
     char *tagsPage;
     uint32 physExec;
     uint32 pageCount;
     void *allocedRam;
     struct preloadData *pd;
+    // Set if the kernel/initrd CRCs were calculated while loading
+    int imageCRC;
+    uint32 crcTable[CRC32_TABLE_SIZE];
 };
 
 // Release resources allocated in prepForKernel.
@@ -373,7 +399,9 @@ cleanupBootMem(struct bootmem *bm)
 {
     if (!bm)
         return;
-    freePages(bm->allocedRam);
+    if (bm->allocedRam)
+        freePages(bm->allocedRam);
+    free(bm->imagePages);
     free(bm);
 }
 
@@ -410,28 +438,55 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
     int initrdCount = PAGE_ALIGN(initrdSize) / PAGE_SIZE;
     int indexCount = PAGE_ALIGN((initrdCount + kernelCount)
                                 * sizeof(char*)) / PAGE_SIZE;
-    int totalCount = kernelCount + initrdCount + indexCount + 4;
-    if (indexCount > MAX_INDEX) {
-        Output(C_ERROR "Image too large (%d+%d) - largest size is %d"
-               , kernelSize, initrdSize
-               , MAX_INDEX * PAGES_PER_INDEX * PAGE_SIZE);
+    int totalCount = kernelCount + initrdCount + indexCount + 5;
+    if (indexCount > (int)PAGES_PER_INDEX) {
+        Output(C_ERROR "Image too large (%d+%d)", kernelSize, initrdSize);
+        return NULL;
+    }
+    uint32 imageEnd = kernelOffset + kernelSize;
+    if (initrdSize && initrdOffset + initrdSize > imageEnd)
+        imageEnd = initrdOffset + initrdSize;
+    if (memPhysSize && imageEnd > memPhysSize) {
+        Output(C_ERROR "Image too large (%d+%d) - ends at offset %08x"
+               " past RAMSIZE=%08x"
+               , kernelSize, initrdSize, imageEnd, memPhysSize);
         return NULL;
     }
 
     // Allocate data structure.
     struct bootmem *bm = (bootmem*)calloc(sizeof(bootmem), 1);
-    if (!bm) {
+    if (bm)
+        bm->imagePages = (char **)malloc(
+            (kernelCount + initrdCount + 1) * sizeof(bm->imagePages[0]));
+    if (!bm || !bm->imagePages) {
         Output(C_ERROR "Failed to allocate bootmem struct");
+        free(bm);
         return NULL;
     }
 
-    struct pageAddrs pages[PAGES_PER_INDEX * MAX_INDEX + 4];
-    bm->pageCount = totalCount;
-    bm->allocedRam = allocPages(pages, totalCount);
+    // Spare pages that land on a kernel/initrd destination are
+    // swapped in below, saving the preloader a copy.
+    uint32 spare = bootSparePages;
+    struct pageAddrs *pages = (struct pageAddrs *)malloc(
+        (totalCount + spare) * sizeof(pages[0]));
+    if (!pages) {
+        Output(C_ERROR "Failed to allocate page list");
+        cleanupBootMem(bm);
+        return NULL;
+    }
+    bm->allocedRam = allocPages(pages, totalCount + spare);
+    if (! bm->allocedRam && spare) {
+        Output(C_WARN "Unable to allocate %d spare pages - trying without"
+               , spare);
+        spare = 0;
+        bm->allocedRam = allocPages(pages, totalCount);
+    }
     if (! bm->allocedRam) {
-	free(bm);
-	return NULL;
+        free(pages);
+        cleanupBootMem(bm);
+        return NULL;
     }
+    bm->pageCount = totalCount + spare;
 
     Output("Built virtual to physical page mapping");
 
@@ -439,6 +494,7 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
     struct pageAddrs *pgs_kernel = &pages[1];
     struct pageAddrs *pgs_initrd = &pages[kernelCount+1];
     struct pageAddrs *pgs_index = &pages[initrdCount+kernelCount+1];
+    struct pageAddrs *pg_dir = &pages[totalCount-4];
     struct pageAddrs *pg_stack = &pages[totalCount-3];
     struct pageAddrs *pg_data = &pages[totalCount-2];
     struct pageAddrs *pg_preload = &pages[totalCount-1];
@@ -448,7 +504,7 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
     uint32 tagsSize = PAGE_SIZE - (tagsOffset % PAGE_SIZE);
 
     // Prevent pages from being overwritten during relocation
-    for (int i=0; i<totalCount; i++) {
+    for (int i=0; i<(int)(totalCount + spare); i++) {
         struct pageAddrs *pg = &pages[i], *ovpg;
         uint32 relPhys = pg->physLoc - memPhysAddr;
         // See if this page will be overwritten in preloader.
@@ -476,19 +532,33 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
         i--;
     }
 
+    // Count the pages the preloader won't have to copy.
+    uint32 inPlace = 0;
+    for (uint32 i=0; i<kernelCount+initrdCount; i++) {
+        uint32 dest = (i < kernelCount
+                       ? kernelOffset + i * PAGE_SIZE
+                       : initrdOffset + (i - kernelCount) * PAGE_SIZE);
+        if (pgs_kernel[i].physLoc == memPhysAddr + dest)
+            inPlace++;
+    }
+
     Output("Allocated %d pages (tags=%p/%08x kernel=%p/%08x initrd=%p/%08x"
-           " index=%p/%08x)"
-           , totalCount
+           " index=%p/%08x dir=%p/%08x)"
+           , totalCount + spare
            , pg_tag->virtLoc, pg_tag->physLoc
            , pgs_kernel->virtLoc, pgs_kernel->physLoc
            , pgs_initrd->virtLoc, pgs_initrd->physLoc
-           , pgs_index->virtLoc, pgs_index->physLoc);
+           , pgs_index->virtLoc, pgs_index->physLoc
+           , pg_dir->virtLoc, pg_dir->physLoc);
 
     // Setup linux tags.
     setup_linux_params(pg_tag->virtLoc, memPhysAddr + initrdOffset, initrdSize);
     Output("Built kernel tags area");
 
     // Setup kernel/initrd indexes
+    uint32 *dir = (uint32*)pg_dir->virtLoc;
+    for (int i=0; i<indexCount; i++)
+        dir[i] = pgs_index[i].physLoc;
     for (uint32 i=0; i<kernelCount+initrdCount; i++) {
         uint32 *index = (uint32*)pgs_index[i/PAGES_PER_INDEX].virtLoc;
         index[i % PAGES_PER_INDEX] = pgs_kernel[i].physLoc;
@@ -497,7 +567,8 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
     bm->kernelPages = &bm->imagePages[0];
     bm->initrdPages = &bm->imagePages[kernelCount];
     bm->tagsPage = pg_tag->virtLoc;
-    Output("Built page index");
+    Output("Built page index - %d of %d pages need relocation"
+           , kernelCount + initrdCount - inPlace, kernelCount + initrdCount);
 
     // Setup preloader data.
     struct preloadData *pd = (struct preloadData *)pg_data->virtLoc;
@@ -509,8 +580,7 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
     pd->kernelSize = kernelSize;
     pd->initrdOffset = initrdOffset;
     pd->initrdSize = initrdSize;
-    for (int i=0; i<indexCount; i++)
-        pd->indexPages[i] = (const char **)pgs_index[i].physLoc;
+    pd->indexDir = (const char ***)pg_dir->physLoc;
     pd->startRam = memPhysAddr;
     pd->preloadStart = (uint32)&preload_start;
     pd->preloadPhys = pg_preload->physLoc;
@@ -545,6 +615,7 @@ prepForKernel(uint32 kernelSize, uint32 initrdSize)
            , sj, pg_stack->virtLoc, pg_stack->physLoc
            , pg_data->virtLoc, pg_data->physLoc, sj->execCode);
 
+    free(pages);
     return bm;
 }
 
@@ -598,14 +669,20 @@ launchKernel(struct bootmem *bm)
     if (! physAddrTram)
         return;
 
-    // Cache an mmu pointer for the trampoline
-    uint8 *virtAddrMmu = memPhysMap(cpuGetMMU());
+    // Pin a mapping of the whole mmu table for the trampoline
+    struct physMapping mmuMap;
+    uint8 *virtAddrMmu = memPhysMapRange(&mmuMap, cpuGetMMU(), 4096 * 4);
     Output("MMU setup: mmu=%p/%08x", virtAddrMmu, cpuGetMMU());
+    if (!virtAddrMmu) {
+        Output(C_ERROR "Unable to map the mmu table");
+        return;
+    }
 
     // Call per-arch setup.
     int ret = Mach->preHardwareShutdown(&bm->pd->fbi);
     if (ret) {
         Output(C_ERROR "Setup for machine shutdown failed");
+        memPhysUnmap(&mmuMap);
         return;
     }
     
@@ -630,6 +707,7 @@ launchKernel(struct bootmem *bm)
 
     // The above should not ever return, but we attempt recovery here.
     return_control();
+    memPhysUnmap(&mmuMap);
 }
 
 
@@ -662,11 +740,15 @@ get_file_size(FILE *fk)
     return size;
 }
 
-// Copy data from a file into memory and check for success.
+// Copy data from a file into memory and check for success.  If
+// 'crctable' is given the CRC of the data is stored in 'crc' - each
+// page is checksummed right after it is read, while it is in cache.
 static int
-file_read(FILE *f, char **pages, uint32 size)
+file_read(FILE *f, char **pages, uint32 origsize
+          , const uint32 *crctable, uint32 *crc)
 {
-    Output("Reading %d bytes...", size);
+    Output("Reading %d bytes...", origsize);
+    uint32 size = origsize, c = 0;
     while (size) {
         uint32 s = size < PAGE_SIZE ? size : PAGE_SIZE;
         uint32 ret = fread(*pages, 1, s, f);
@@ -674,10 +756,14 @@ file_read(FILE *f, char **pages, uint32 size)
             Output(C_ERROR "Error reading file.  Expected %d got %d", s, ret);
             return -1;
         }
+        if (crctable)
+            c = crc32_be(crctable, c, *pages, s);
         pages++;
         size -= s;
         AddProgress(s);
     }
+    if (crctable)
+        *crc = crc32_be_finish(crctable, c, origsize);
     Output("Read complete");
     return 0;
 }
@@ -691,23 +777,31 @@ loadHandleKernel(FILE *fKernel, FILE *fInitrd, int kernelSize, int initrdSize)
 {
     // Obtain ram for the kernel
     int ret;
+    const uint32 *crctable = NULL;
     struct bootmem *bm = NULL;
     bm = prepForKernel(kernelSize, initrdSize);
     if (!bm)
         goto abort;
+    if (KernelCRC) {
+        crc32_be_init(bm->crcTable);
+        crctable = bm->crcTable;
+    }
 
     InitProgress(DLG_PROGRESS_BOOT, kernelSize + initrdSize);
 
     // Load kernel
-    ret = file_read(fKernel, bm->kernelPages, kernelSize);
+    ret = file_read(fKernel, bm->kernelPages, kernelSize
+                    , crctable, &bm->pd->kernelCRC);
     if (ret)
         goto abort;
     // Load initrd
     if (fInitrd) {
-        ret = file_read(fInitrd, bm->initrdPages, initrdSize);
+        ret = file_read(fInitrd, bm->initrdPages, initrdSize
+                        , crctable, &bm->pd->initrdCRC);
 	if (ret)
     	goto abort;
     }
+    bm->imageCRC = (crctable != NULL);
 
     DoneProgress();
 
@@ -784,23 +878,19 @@ resumeIntoBoot(struct bootmem *bm)
  * Boot code
  ****************************************************************/
 
-static uint32 KernelCRC;
-REG_VAR_INT(0, "KERNELCRC", KernelCRC
-            , "If set, perform a CRC check on the kernel/initrd.")
-
 // Test the CRC of a set of pages.
 static uint32
-crc_pages(char **pages, uint32 origsize)
+crc_pages(const uint32 *crctable, char **pages, uint32 origsize)
 {
     uint32 crc = 0;
     uint32 size = origsize;
     while (size) {
         uint32 s = size < PAGE_SIZE ? size : PAGE_SIZE;
-        crc = crc32_be(crc, *pages, s);
+        crc = crc32_be(crctable, crc, *pages, s);
         pages++;
         size -= s;
     }
-    return crc32_be_finish(crc, origsize);
+    return crc32_be_finish(crctable, crc, origsize);
 }
 
 // Boot a kernel loaded into memory via one of two mechanisms.
@@ -809,10 +899,18 @@ tryLaunch(struct bootmem *bm, int bootViaResume)
 {
     // Setup CRC (if enabled).
     if (KernelCRC) {
-        bm->pd->tagsCRC = crc_pages(&bm->tagsPage, bm->pd->tagsSize);
-        bm->pd->kernelCRC = crc_pages(bm->kernelPages, bm->pd->kernelSize);
-        if (bm->pd->initrdSize)
-            bm->pd->initrdCRC = crc_pages(bm->initrdPages, bm->pd->initrdSize);
+        uint32 *crctable = bm->crcTable;
+        if (!bm->imageCRC) {
+            // Not calculated while loading - read the pages again.
+            crc32_be_init(crctable);
+            bm->pd->kernelCRC = crc_pages(crctable, bm->kernelPages
+                                          , bm->pd->kernelSize);
+            if (bm->pd->initrdSize)
+                bm->pd->initrdCRC = crc_pages(crctable, bm->initrdPages
+                                              , bm->pd->initrdSize);
+        }
+        bm->pd->tagsCRC = crc_pages(crctable, &bm->tagsPage
+                                    , bm->pd->tagsSize);
         bm->pd->doCRC = 1;
         Output("CRC test complete.  tags=%u kernel=%u initrd=%u"
                , bm->pd->tagsCRC, bm->pd->kernelCRC, bm->pd->initrdCRC);
@@ -857,17 +955,24 @@ REG_CMD_ALT(
  * Boot from kernel already in ram
  ****************************************************************/
 
+// Copy data into the image pages (calculating its CRC as file_read).
 static void
-copy_pages(char **pages, const char *src, uint32 size)
+copy_pages(char **pages, const char *src, uint32 origsize
+           , const uint32 *crctable, uint32 *crc)
 {
+    uint32 size = origsize, c = 0;
     while (size) {
         uint32 s = size < PAGE_SIZE ? size : PAGE_SIZE;
         memcpy(*pages, src, s);
+        if (crctable)
+            c = crc32_be(crctable, c, *pages, s);
         src += s;
         pages++;
         size -= s;
         AddProgress(s);
     }
+    if (crctable)
+        *crc = crc32_be_finish(crctable, c, origsize);
 }
 
 // Load a kernel already in memory, disable hardware, and jump into
@@ -882,10 +987,19 @@ bootRamLinux(const char *kernel, uint32 kernelSize
     if (!bm)
         return;
 
+    const uint32 *crctable = NULL;
+    if (KernelCRC) {
+        crc32_be_init(bm->crcTable);
+        crctable = bm->crcTable;
+    }
+
     // Copy kernel / initrd.
     InitProgress(DLG_PROGRESS_BOOT, kernelSize + initrdSize);
-    copy_pages(bm->kernelPages, kernel, kernelSize);
-    copy_pages(bm->initrdPages, initrd, initrdSize);
+    copy_pages(bm->kernelPages, kernel, kernelSize
+               , crctable, &bm->pd->kernelCRC);
+    copy_pages(bm->initrdPages, initrd, initrdSize
+               , crctable, &bm->pd->initrdCRC);
+    bm->imageCRC = (crctable != NULL);
     DoneProgress();
 
     // Launch it.
@@ -903,3 +1017,91 @@ bootHandleLinux(FILE *f, int kernelSize, int initrdSize, int bootViaResume)
     // Launch it.
     tryLaunch(bm, bootViaResume);
 }
+
+
+/****************************************************************
+ * Relocation benchmark
+ ****************************************************************/
+
+// The one word at a time copy do_copy used to do - for comparison.
+static void
+copyWords(char *dest, const char *src, int count)
+{
+    uint32 *d = (uint32*)dest, *s = (uint32*)src, *e = (uint32*)&src[count];
+    while (s < e)
+        *d++ = *s++;
+}
+
+// Time copying pages through uncached mappings (as the preloader
+// sees memory) with the given copy function.  Returns milliseconds.
+static uint32
+timeCopy(void (*copy)(char *, const char *, int)
+         , uint8 **src, uint8 **dst, uint32 pages, uint32 rounds)
+{
+    uint32 start = GetTickCount();
+    for (uint32 r = 0; r < rounds; r++)
+        for (uint32 i = 0; i < pages; i++)
+            copy((char*)dst[i], (char*)src[i], PAGE_SIZE);
+    return GetTickCount() - start;
+}
+
+static void
+cmd_copybench(const char *cmd, const char *args)
+{
+    uint32 pages, rounds;
+    if (!get_expression(&args, &pages))
+        pages = 256;
+    if (!get_expression(&args, &rounds))
+        rounds = 4;
+    if (!pages || !rounds) {
+        ScriptError("Expected [<pages> [<rounds>]]");
+        return;
+    }
+
+    struct pageAddrs *pg = (struct pageAddrs *)malloc(
+        pages * 2 * sizeof(*pg));
+    struct physMapping *pm = (struct physMapping *)calloc(
+        pages * 2, sizeof(*pm));
+    uint8 **virt = (uint8 **)calloc(pages * 2, sizeof(*virt));
+    void *data = NULL;
+    uint32 mapped = 0;
+    if (!pg || !pm || !virt) {
+        Output(C_ERROR "Failed to allocate buffer");
+        goto out;
+    }
+    data = allocPages(pg, pages * 2);
+    if (!data)
+        goto out;
+    for (mapped = 0; mapped < pages * 2; mapped++) {
+        virt[mapped] = memPhysMapRange(&pm[mapped], pg[mapped].physLoc
+                                       , PAGE_SIZE);
+        if (!virt[mapped]) {
+            Output(C_ERROR "Unable to map page %08x", pg[mapped].physLoc);
+            goto out;
+        }
+    }
+
+    {
+        uint32 kb = pages * rounds * PAGE_SIZE / 1024;
+        uint32 old = timeCopy(copyWords, virt, &virt[pages], pages, rounds);
+        uint32 burst = timeCopy(do_copy, virt, &virt[pages], pages, rounds);
+        Output("Copied %d KB uncached: word loop %d ms, burst %d ms"
+               , kb, old, burst);
+        if (old && burst)
+            Output("Relocating a 16MB image: %d ms -> %d ms"
+                   , old * 16384 / kb, burst * 16384 / kb);
+    }
+
+out:
+    for (uint32 i = 0; i < mapped; i++)
+        memPhysUnmap(&pm[i]);
+    if (data)
+        freePages(data);
+    free(virt);
+    free(pm);
+    free(pg);
+}
+REG_CMD(0, "COPYBENCH", cmd_copybench,
+        "COPYBENCH [<pages> [<rounds>]]\n"
+        "  Compare the preloader's burst page copy with a one word at a\n"
+        "  time copy, using uncached mappings like the preloader sees.")
@@ -2,7 +2,7 @@
 #include "script.h" // runMemScript
 #include "arch-arm.h" // cpuFlushCache_arm6
 #include "arch-msm.h"
-#include "memory.h" // memPhysMap
+#include "memory.h" // memPhysMapRange
 #include "linboot.h" // __preload
 #include "video.h" // vidGetVRAM
 #include "fbwrite.h" // fb_putc / struct fbinfo
@@ -161,20 +161,20 @@ MachineQSD8xxx::shutdownInterrupts()
 {
     uint32 dummyRead;
 
-    // Map the interrupt controller registers
-    uint32 volatile *VIC_INT_SELECT0		= (uint32*)memPhysMap(0xAC000000+0x0000);
-    uint32 volatile *VIC_INT_SELECT1		= (uint32*)memPhysMap(0xAC000000+0x0004);
-    uint32 volatile *VIC_INT_EN0		= (uint32*)memPhysMap(0xAC000000+0x0010);
-    uint32 volatile *VIC_INT_EN1		= (uint32*)memPhysMap(0xAC000000+0x0014);
-    uint32 volatile *VIC_INT_TYPE0		= (uint32*)memPhysMap(0xAC000000+0x0040);
-    uint32 volatile *VIC_INT_TYPE1		= (uint32*)memPhysMap(0xAC000000+0x0044);
-    uint32 volatile *VIC_INT_POLARITY0		= (uint32*)memPhysMap(0xAC000000+0x0050);
-    uint32 volatile *VIC_INT_POLARITY1		= (uint32*)memPhysMap(0xAC000000+0x0054);
-    uint32 volatile *VIC_CONFIG			= (uint32*)memPhysMap(0xAC000000+0x006C);
-    uint32 volatile *VIC_INT_MASTEREN		= (uint32*)memPhysMap(0xAC000000+0x0068);
-    uint32 volatile *VIC_IRQ_VEC_RD		= (uint32*)memPhysMap(0xAC000000+0x00D0);
-    uint32 volatile *VIC_IRQ_VEC_PEND_RD	= (uint32*)memPhysMap(0xAC000000+0x00D4);
-    uint32 volatile *VIC_IRQ_VEC_WR		= (uint32*)memPhysMap(0xAC000000+0x00D8);
+    // The interrupt controller registers (mapped by preHardwareShutdown)
+    uint32 volatile *VIC_INT_SELECT0		= (uint32*)(vicRegs + 0x0000);
+    uint32 volatile *VIC_INT_SELECT1		= (uint32*)(vicRegs + 0x0004);
+    uint32 volatile *VIC_INT_EN0		= (uint32*)(vicRegs + 0x0010);
+    uint32 volatile *VIC_INT_EN1		= (uint32*)(vicRegs + 0x0014);
+    uint32 volatile *VIC_INT_TYPE0		= (uint32*)(vicRegs + 0x0040);
+    uint32 volatile *VIC_INT_TYPE1		= (uint32*)(vicRegs + 0x0044);
+    uint32 volatile *VIC_INT_POLARITY0		= (uint32*)(vicRegs + 0x0050);
+    uint32 volatile *VIC_INT_POLARITY1		= (uint32*)(vicRegs + 0x0054);
+    uint32 volatile *VIC_CONFIG			= (uint32*)(vicRegs + 0x006C);
+    uint32 volatile *VIC_INT_MASTEREN		= (uint32*)(vicRegs + 0x0068);
+    uint32 volatile *VIC_IRQ_VEC_RD		= (uint32*)(vicRegs + 0x00D0);
+    uint32 volatile *VIC_IRQ_VEC_PEND_RD	= (uint32*)(vicRegs + 0x00D4);
+    uint32 volatile *VIC_IRQ_VEC_WR		= (uint32*)(vicRegs + 0x00D8);
 
     // Disable the interrupt controller
     *VIC_INT_MASTEREN = 0;
@@ -199,16 +199,16 @@ void
 MachineQSD8xxx::shutdownSirc()
 {
     // Shut down the second interrupt controller
-    uint32 volatile *SIRC_INT_SELECT        = (uint32*)memPhysMap(0xAC200000+0x00);
-    uint32 volatile *SIRC_INT_ENABLE        = (uint32*)memPhysMap(0xAC200000+0x04);
-    uint32 volatile *SIRC_INT_ENABLE_CLEAR  = (uint32*)memPhysMap(0xAC200000+0x08);
-    uint32 volatile *SIRC_INT_ENABLE_SET    = (uint32*)memPhysMap(0xAC200000+0x0C);
-    uint32 volatile *SIRC_INT_TYPE          = (uint32*)memPhysMap(0xAC200000+0x10);
-    uint32 volatile *SIRC_INT_POLARITY      = (uint32*)memPhysMap(0xAC200000+0x14);
-    uint32 volatile *SIRC_INT_IRQ_STATUS    = (uint32*)memPhysMap(0xAC200000+0x1C);
-    uint32 volatile *SIRC_INT_IRQ1_STATUS   = (uint32*)memPhysMap(0xAC200000+0x20);
-    uint32 volatile *SIRC_INT_RAW_STATUS    = (uint32*)memPhysMap(0xAC200000+0x24);
-    uint32 volatile *SIRC_INT_CLEAR         = (uint32*)memPhysMap(0xAC200000+0x28);
+    uint32 volatile *SIRC_INT_SELECT        = (uint32*)(sircRegs + 0x00);
+    uint32 volatile *SIRC_INT_ENABLE        = (uint32*)(sircRegs + 0x04);
+    uint32 volatile *SIRC_INT_ENABLE_CLEAR  = (uint32*)(sircRegs + 0x08);
+    uint32 volatile *SIRC_INT_ENABLE_SET    = (uint32*)(sircRegs + 0x0C);
+    uint32 volatile *SIRC_INT_TYPE          = (uint32*)(sircRegs + 0x10);
+    uint32 volatile *SIRC_INT_POLARITY      = (uint32*)(sircRegs + 0x14);
+    uint32 volatile *SIRC_INT_IRQ_STATUS    = (uint32*)(sircRegs + 0x1C);
+    uint32 volatile *SIRC_INT_IRQ1_STATUS   = (uint32*)(sircRegs + 0x20);
+    uint32 volatile *SIRC_INT_RAW_STATUS    = (uint32*)(sircRegs + 0x24);
+    uint32 volatile *SIRC_INT_CLEAR         = (uint32*)(sircRegs + 0x28);
 
     *SIRC_INT_ENABLE = 0;
     *SIRC_INT_ENABLE_CLEAR = 0;
@@ -225,15 +225,15 @@ MachineQSD8xxx::shutdownSirc()
 void
 MachineQSD8xxx::shutdownTimers()
 {
-    // Map the timer registers
-    uint32 volatile *AGPT_MATCH_VAL = (uint32*)memPhysMap(0xAC100000);
-    uint32 volatile *AGPT_COUNT_VAL = (uint32*)memPhysMap(0xAC100004);
-    uint32 volatile *AGPT_ENABLE    = (uint32*)memPhysMap(0xAC100008);
-    uint32 volatile *AGPT_CLEAR     = (uint32*)memPhysMap(0xAC10000C);
-    uint32 volatile *ADGT_MATCH_VAL = (uint32*)memPhysMap(0xAC100010);
-    uint32 volatile *ADGT_COUNT_VAL = (uint32*)memPhysMap(0xAC100014);
-    uint32 volatile *ADGT_ENABLE    = (uint32*)memPhysMap(0xAC100018);
-    uint32 volatile *ADGT_CLEAR     = (uint32*)memPhysMap(0xAC10001C);
+    // The timer registers (mapped by preHardwareShutdown)
+    uint32 volatile *AGPT_MATCH_VAL = (uint32*)(timerRegs + 0x00);
+    uint32 volatile *AGPT_COUNT_VAL = (uint32*)(timerRegs + 0x04);
+    uint32 volatile *AGPT_ENABLE    = (uint32*)(timerRegs + 0x08);
+    uint32 volatile *AGPT_CLEAR     = (uint32*)(timerRegs + 0x0C);
+    uint32 volatile *ADGT_MATCH_VAL = (uint32*)(timerRegs + 0x10);
+    uint32 volatile *ADGT_COUNT_VAL = (uint32*)(timerRegs + 0x14);
+    uint32 volatile *ADGT_ENABLE    = (uint32*)(timerRegs + 0x18);
+    uint32 volatile *ADGT_CLEAR     = (uint32*)(timerRegs + 0x1C);
 
     // Disable GP timer
     *AGPT_ENABLE = 0;
@@ -261,7 +261,8 @@ MachineQSD8xxx::shutdownDMA()
 {
     for (int i=0; i < MSM_DMOV_CHANNEL_COUNT; i++)
     {
-        uint32 volatile *dmaChannelConfig = (uint32*)memPhysMap(DMOV_CONFIG(i));
+        uint32 volatile *dmaChannelConfig =
+            (uint32*)(dmovRegs + DMOV_CONFIG(i) - MSM_DMOV_PHYS);
         *dmaChannelConfig = 0;
     }
 }
@@ -312,27 +313,49 @@ QSD8xxxFbPutc(struct fbinfo *fbi, char c)
     }
 }
 
-void
+int
 MachineQSD8xxx::configureFb(struct fbinfo *fbi)
 {
     // Cast the data pointer so we can use it to contain our own data
     QSD8xxxFbDmaData* data = (QSD8xxxFbDmaData*)fbi->putcFuncData;
 
     // Get a mapping for the physical addresses we'll need to do the DMA
-    data->fbDmaSize = memPhysMap(0xaa200000 + 0x90004);
-    data->fbDmaPhysFb = memPhysMap(0xaa200000 + 0x90008);
-    data->fbDmaStride = memPhysMap(0xaa200000 + 0x9000c);
-    data->fbDmaStart = memPhysMap(0xaa200000 + 0x00044);
+    uint8 *dma = memPhysMapRange(&fbDmaMap, 0xaa200000 + 0x90004, 3*4);
+    uint8 *start = memPhysMapRange(&fbStartMap, 0xaa200000 + 0x00044, 4);
+    if (!dma || !start)
+        return -1;
+    data->fbDmaSize = dma;
+    data->fbDmaPhysFb = dma + 4;
+    data->fbDmaStride = dma + 8;
+    data->fbDmaStart = start;
     data->fbPhysAddr = vidGetVRAM();
 
     // Override the fb_putc() with our own function
     fbi->putcFunc = &QSD8xxxFbPutc;
+    return 0;
 }
 
 int
 MachineQSD8xxx::preHardwareShutdown(struct fbinfo *fbi)
 {
-    configureFb(fbi);
+    // Map all the registers now - hardwareShutdown runs with
+    // interrupts off, where new windows can't be created.
+    vicRegs = memPhysMapRange(&vicMap, 0xAC000000, 0xD8 + 4);
+    sircRegs = memPhysMapRange(&sircMap, 0xAC200000, 0x28 + 4);
+    timerRegs = memPhysMapRange(&timerMap, 0xAC100000, 0x1C + 4);
+    dmovRegs = memPhysMapRange(&dmovMap, MSM_DMOV_PHYS
+                               , DMOV_CONFIG(MSM_DMOV_CHANNEL_COUNT)
+                               - MSM_DMOV_PHYS);
+    int ret = configureFb(fbi);
+    if (ret || !vicRegs || !sircRegs || !timerRegs || !dmovRegs) {
+        memPhysUnmap(&vicMap);
+        memPhysUnmap(&sircMap);
+        memPhysUnmap(&timerMap);
+        memPhysUnmap(&dmovMap);
+        memPhysUnmap(&fbDmaMap);
+        memPhysUnmap(&fbStartMap);
+        return -1;
+    }
     return 0;
 }
 
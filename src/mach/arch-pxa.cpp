@@ -1,6 +1,6 @@
 #include <string.h> // strncmp
 #include "cpu.h" // DEF_GETCPR
-#include "memory.h" // memPhysMap
+#include "memory.h" // memPhysMapRange
 #include "script.h" // runMemScript
 #include "arch-pxa.h"
 #define CONFIG_PXA25x
@@ -62,10 +62,13 @@ int
 MachinePXA::preHardwareShutdown(struct fbinfo *fbi)
 {
     /* Map now everything we'll need later */
-    dma = (uint32 *)memPhysMap(DMA_BASE_ADDR);
-    udc = (uint32 *)memPhysMap(UDC_BASE_ADDR);
-    if (! dma || ! udc)
+    dma = (uint32 *)memPhysMapRange(&dmaMap, DMA_BASE_ADDR, sizeof(pxaDMA));
+    udc = (uint32 *)memPhysMapRange(&udcMap, UDC_BASE_ADDR, sizeof(pxaUDC));
+    if (! dma || ! udc) {
+        memPhysUnmap(&dmaMap);
+        memPhysUnmap(&udcMap);
         return -1;
+    }
     return 0;
 }
 
@@ -1,5 +1,5 @@
 #include "cpu.h" // DEF_GETCPR
-#include "memory.h" // memPhysMap
+#include "memory.h" // memPhysMapRange
 #include "script.h" // runMemScript
 #include "arch-pxa.h"
 #define CONFIG_PXA27x
@@ -71,10 +71,15 @@ MachinePXA27x::preHardwareShutdown(struct fbinfo *fbi)
     int ret = MachinePXA::preHardwareShutdown(fbi);
     if (ret)
         return ret;
-    cken = (uint32 *)memPhysMap(CKEN);
-    uhccoms = (uint32 *)memPhysMap(UHCCOMS);
-    if (! cken || ! uhccoms)
+    cken = (uint32 *)memPhysMapRange(&ckenMap, CKEN, 4);
+    uhccoms = (uint32 *)memPhysMapRange(&uhccomsMap, UHCCOMS, 4);
+    if (! cken || ! uhccoms) {
+        memPhysUnmap(&ckenMap);
+        memPhysUnmap(&uhccomsMap);
+        memPhysUnmap(&dmaMap);
+        memPhysUnmap(&udcMap);
         return -1;
+    }
     return 0;
 }
 
@@ -255,20 +255,41 @@ MachineS3c6400::init()
         );
 }
 
+static const uint32 S3C6410_DMA_CTRL_LIST[] =
+{ S3C6400_PA_DMA0, S3C6400_PA_DMA1, S3C6400_PA_SDMA0, S3C6400_PA_SDMA1 };
+
+// Release the mappings made by preHardwareShutdown.
+void
+MachineS3c6400::unmapShutdownRegs()
+{
+	for (int i = 0; i < 4; i++)
+		memPhysUnmap(&dmaMap[i]);
+	for (int i = 0; i < 2; i++)
+		memPhysUnmap(&vicMap[i]);
+	memPhysUnmap(&sdmaSelMap);
+	memPhysUnmap(&usbSigMap);
+	memPhysUnmap(&usbOtgMap);
+}
+
 int
 MachineS3c6400::preHardwareShutdown(struct fbinfo *fbi)
 {
-	dma_base[0] = (uint32*)memPhysMap(S3C6400_PA_DMA0);
-	dma_base[1] = (uint32*)memPhysMap(S3C6400_PA_DMA1);
-/*	dma_base[2] = (uint32*)memPhysMap(S3C6400_PA_SDMA0);
-	dma_base[3] = (uint32*)memPhysMap(S3C6400_PA_SDMA1);
-*/
-	usb_sigmask = (unsigned char *)memPhysMap(S3C6410_USB_SIG_MASK);
-    	usb_otgsfr = (uint32*)memPhysMap(S3C6410_PA_OTGSFR);
-
-	if //(!dma_base[0] || !dma_base[1] || !dma_base[2] || !dma_base[3]) ||
-	   (!usb_sigmask || !usb_otgsfr)
+	// Everything hardwareShutdown touches is mapped here - it runs
+	// with interrupts off, where new windows can't be created.
+	for (int i = 0; i < 4; i++)
+		dma_base[i] = (uint32*)memPhysMapRange(
+			&dmaMap[i], S3C6410_DMA_CTRL_LIST[i], PL080S_Cx_CONFIG(8));
+	vic[0] = (uint32*)memPhysMapRange(&vicMap[0], S3C6400_PA_VIC0, 0x18);
+	vic[1] = (uint32*)memPhysMapRange(&vicMap[1], S3C6400_PA_VIC1, 0x18);
+	sdma_selreg = (uint32*)memPhysMapRange(&sdmaSelMap, 0x7E00F110, 4);
+	usb_sigmask = (unsigned char *)memPhysMapRange(
+		&usbSigMap, S3C6410_USB_SIG_MASK, 4);
+	usb_otgsfr = (uint32*)memPhysMapRange(&usbOtgMap, S3C6410_PA_OTGSFR, 3*4);
+
+	if (!usb_sigmask || !usb_otgsfr || !vic[0] || !vic[1]) {
+		unmapShutdownRegs();
 		return -1;
+	}
 
 	return 0;
 }
@@ -301,10 +322,7 @@ MachineS3c6400::s3c6400ShutdownDMA(struct fbinfo *fbi)
 
 	int ctrl_count=4;
 
-	const uint32 S3C6410_DMA_CTRL_LIST[] =
-	{ S3C6400_PA_DMA0, S3C6400_PA_DMA1, S3C6400_PA_SDMA0, S3C6400_PA_SDMA1 };
-
-	SDMA_SEL = (uint32*)memPhysMap(0x7E00F110);
+	SDMA_SEL = sdma_selreg;
 	if (SDMA_SEL) {
 		sdma_sel = SDMA_SEL[0];
 		fb_printf(fbi,"%s: SDMA_SEL=%x", __func__, sdma_sel);
@@ -321,7 +339,7 @@ MachineS3c6400::s3c6400ShutdownDMA(struct fbinfo *fbi)
 	/* 6410 : we have 2 (+2 secure) controllers with 8 channels each */
 	for (dma_ctrl = 0; dma_ctrl < ctrl_count; dma_ctrl++) {
 
-		DMA_CTRL = (uint32*) memPhysMap(S3C6410_DMA_CTRL_LIST[dma_ctrl]);
+		DMA_CTRL = dma_base[dma_ctrl];
 		if (DMA_CTRL) {
 
 			config = s3c_readl(DMA_CTRL, PL080_EN_CHAN);
@@ -396,9 +414,9 @@ MachineS3c6400::clearIRQS(void)
 	volatile uint32 * VIC;
 
 	//VICxINTENCLEAR = VICxINTENABLE
-	VIC=(uint32*)memPhysMap(S3C6400_PA_VIC0);
+	VIC=vic[0];
 	VIC[0x14/4] = 0xFFFFFF7F; //VIC[0x10/4];
-	VIC=(uint32*)memPhysMap(S3C6400_PA_VIC1);
+	VIC=vic[1];
 	VIC[0x14/4] = 0xFFFFFFFF; //VIC[0x10/4];
 }
 
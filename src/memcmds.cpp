@@ -4,8 +4,11 @@
 //
 //  For conditions of use see file COPYING
 
+#include <windows.h> // CreateThread, WriteFile
 #include <ctype.h> // toupper
 #include <stdio.h> // FILE
+#include <stdlib.h> // malloc
+#include <string.h> // memcmp
 
 #include "output.h" // Output
 #include "memory.h" // memPhysMap
@@ -15,6 +18,8 @@
 #include "resource.h" // DLG_PROGRESS
 #include "machines.h" // Mach
 #include "memcmds.h"
+#include "mmumap.h" // struct mmuMapRecord
+#include "memsearch.h" // searchRange
 
 
 /****************************************************************
@@ -61,80 +66,424 @@ static bool alignMemAddr(uint32 *addrLoc)
     return false;
 }
 
-// Dump a portion of memory to file
+// Number of bytes shown on each line of a memory dump
+#define DUMP_LINE 16
+// Longest line: address, 16 byte columns and the character dump
+#define DUMP_LINEMAX (8 + 2 + 16 * 3 + 3 + DUMP_LINE + 1)
+// Lines are collected and sent to Output() in chunks of this size
+// (it must stay below Output's internal buffer size).
+#define DUMP_BUFSIZE 1536
+
+static uint32 DumpSkip = 1;
+REG_VAR_INT(0, "DUMPSKIP", DumpSkip
+            , "Replace repeated lines in [V|P]DUMP output by '*' (0 to disable)")
+
+static const char HexChars[] = "0123456789abcdef";
+
+// State of a memory dump in progress.
+struct hexDump {
+    int wordsize;
+    // Address of the end of the dump
+    uint32 end;
+    // Previous line (for detecting repeats)
+    uint8 last[DUMP_LINE];
+    int haveLast, skipping;
+    uint32 len;
+    char buf[DUMP_BUFSIZE];
+};
+
 static void
-memDump(uint8 *vaddr, uint32 size, uint32 base = (uint32)-1)
+dumpInit(struct hexDump *hd, int wordsize, uint32 end)
 {
-    uint32 offs = 0;
-    char chrdump[17];
-    chrdump[16] = 0;
-
-    if (base == (uint32)-1)
-        base = (uint32)vaddr;
+    hd->wordsize = wordsize;
+    hd->end = end;
+    hd->haveLast = hd->skipping = 0;
+    hd->len = 0;
+}
 
-    while (offs < size) {
-        if ((offs & 15) == 0) {
-            if (offs)
-                Output(" | %s", chrdump);
-            Output("%08x |\t", base + offs);
-        }
+// Send the rendered lines to Output().
+static void
+dumpFlush(struct hexDump *hd)
+{
+    if (!hd->len)
+        return;
+    // Output() adds the final newline itself.
+    hd->buf[hd->len - 1] = 0;
+    Output("%s", hd->buf);
+    hd->len = 0;
+}
 
-        uint32 d = memRead(vaddr + offs, MO_SIZE32);
-        Output(" %08x\t", d);
+static inline char *
+putHex(char *p, uint32 v, int digits)
+{
+    char *e = p + digits;
+    p = e;
+    while (digits--) {
+        *--p = HexChars[v & 15];
+        v >>= 4;
+    }
+    return e;
+}
 
-        chrdump[(offs & 15) + 0] = dump_char((d      ) & 0xff);
-        chrdump[(offs & 15) + 1] = dump_char((d >>  8) & 0xff);
-        chrdump[(offs & 15) + 2] = dump_char((d >> 16) & 0xff);
-        chrdump[(offs & 15) + 3] = dump_char((d >> 24) & 0xff);
+// Render 'len' (at most DUMP_LINE) bytes at 'data' that were read
+// from address 'addr'.
+static void
+dumpLine(struct hexDump *hd, uint32 addr, const uint8 *data, uint32 len)
+{
+    // Like hexdump, a run of identical lines is shown as a single
+    // '*' - the last line of the dump is always shown.
+    if (DumpSkip && hd->haveLast && len == DUMP_LINE
+        && addr + DUMP_LINE < hd->end
+        && !memcmp(data, hd->last, DUMP_LINE)) {
+        if (!hd->skipping) {
+            if (hd->len + 2 > sizeof(hd->buf))
+                dumpFlush(hd);
+            hd->buf[hd->len++] = '*';
+            hd->buf[hd->len++] = '\n';
+            hd->skipping = 1;
+        }
+        return;
+    }
+    hd->skipping = 0;
+    hd->haveLast = (len == DUMP_LINE);
+    memcpy(hd->last, data, len);
+
+    if (hd->len + DUMP_LINEMAX > sizeof(hd->buf))
+        dumpFlush(hd);
+    char *p = &hd->buf[hd->len];
+    p = putHex(p, addr, 8);
+    *p++ = ' ';
+    *p++ = '|';
+    uint32 bytes = 1 << hd->wordsize;
+    for (uint32 i = 0; i < DUMP_LINE; i += bytes) {
+        *p++ = ' ';
+        if (i >= len) {
+            memset(p, ' ', bytes * 2);
+            p += bytes * 2;
+            continue;
+        }
+        switch (hd->wordsize) {
+        case MO_SIZE8:
+            p = putHex(p, data[i], 2);
+            break;
+        case MO_SIZE16:
+            p = putHex(p, *(uint16*)&data[i], 4);
+            break;
+        default:
+            p = putHex(p, *(uint32*)&data[i], 8);
+            break;
+        }
+    }
+    *p++ = ' ';
+    *p++ = '|';
+    *p++ = ' ';
+    for (uint32 i = 0; i < len; i++)
+        *p++ = dump_char(data[i]);
+    *p++ = '\n';
+    hd->len = p - hd->buf;
+}
 
-        offs += 4;
+// Read a line of virtual memory using 'wordsize' accesses.  Returns
+// false if an exception occurred.
+static bool
+memReadLine(uint8 *dst, uint8 *vaddr, uint32 len, int wordsize)
+{
+    TRY_EXCEPTION_HANDLER {
+        uint32 i;
+        switch (wordsize) {
+        case MO_SIZE8:
+            for (i = 0; i < len; i++)
+                dst[i] = vaddr[i];
+            break;
+        case MO_SIZE16:
+            for (i = 0; i < len; i += 2)
+                *(uint16*)&dst[i] = *(uint16*)&vaddr[i];
+            break;
+        default:
+            for (i = 0; i < len; i += 4)
+                *(uint32*)&dst[i] = *(uint32*)&vaddr[i];
+            break;
+        }
+    } CATCH_EXCEPTION_HANDLER {
+        return false;
     }
+    return true;
+}
 
-    while (offs & 15) {
-        Output("         \t");
-        chrdump[offs & 15] = 0;
-        offs += 4;
+// Dump a portion of virtual memory
+static void
+memDump(uint8 *vaddr, uint32 size, int wordsize)
+{
+    struct hexDump hd;
+    dumpInit(&hd, wordsize, (uint32)vaddr + size);
+    uint32 line[DUMP_LINE / 4];
+    for (uint32 offs = 0; offs < size; offs += DUMP_LINE) {
+        uint32 len = size - offs < DUMP_LINE ? size - offs : DUMP_LINE;
+        uint8 *data = (uint8*)line;
+        if (!memReadLine(data, vaddr + offs, len, wordsize)) {
+            // Find (and report) the words that fault.
+            for (uint32 i = 0; i < len; i += 1 << wordsize) {
+                uint32 v = memRead(vaddr + offs + i, wordsize);
+                memcpy(&data[i], &v, 1 << wordsize);
+            }
+        }
+        dumpLine(&hd, (uint32)vaddr + offs, data, len);
     }
+    dumpFlush(&hd);
+}
 
-    Output(" | %s", chrdump);
+// Read physical memory using 'wordsize' accesses, so that peripheral
+// registers see the access width asked for.  Returns the number of
+// bytes read.
+static uint32
+memPhysReadWidth(uint8 *dst, uint32 paddr, uint32 len, int wordsize)
+{
+    struct physMapping pm;
+    uint8 *src = memPhysMapRange(&pm, paddr, len);
+    if (!src)
+        return 0;
+    uint32 done = 0;
+    while (done < len) {
+        uint32 l = len - done < DUMP_LINE ? len - done : DUMP_LINE;
+        if (!memReadLine(dst + done, src + done, l, wordsize))
+            break;
+        done += l;
+    }
+    memPhysUnmap(&pm);
+    return done;
 }
 
-// Dump a portion of physical memory to file
-static void memPhysDump(uint32 paddr, uint32 size)
+// Dump a portion of physical memory
+static void memPhysDump(uint32 paddr, uint32 size, int wordsize)
 {
+    struct hexDump hd;
+    dumpInit(&hd, wordsize, paddr + size);
+    uint32 buf[4096 / 4];
+    if (wordsize == MO_SIZE32)
+        memPhysReadSync();
     while (size) {
-        uint8 *vaddr = memPhysMap(paddr);
-        uint32 bytes = PHYS_CACHE_SIZE - (PHYS_CACHE_MASK & (uint32)vaddr);
-        if (bytes > size)
-            bytes = size;
-        memDump(vaddr, bytes, paddr);
+        uint32 bytes = size > sizeof(buf) ? sizeof(buf) : size;
+        // Word columns are read in bulk (ldm bursts are word accesses
+        // too) - narrower columns use accesses of their own width.
+        uint32 got = (wordsize == MO_SIZE32
+                      ? memPhysReadBlock(buf, paddr, bytes)
+                      : memPhysReadWidth((uint8*)buf, paddr, bytes, wordsize));
+        for (uint32 offs = 0; offs < got; offs += DUMP_LINE)
+            dumpLine(&hd, paddr + offs, (uint8*)buf + offs
+                     , got - offs < DUMP_LINE ? got - offs : DUMP_LINE);
+        if (got != bytes) {
+            dumpFlush(&hd);
+            Output(C_ERROR "Unable to read physical address %08x"
+                   , paddr + got);
+            return;
+        }
         size -= bytes;
         paddr += bytes;
     }
+    dumpFlush(&hd);
 }
 
 static void
 cmd_memaccess(const char *tok, const char *args)
 {
     bool virt = toupper(tok[0]) == 'V';
-    uint32 addr, size;
+    uint32 addr, size, bits;
     if (!get_expression(&args, &addr) || !get_expression(&args, &size)) {
-        ScriptError("Expected <addr> <size>");
+        ScriptError("Expected <addr> <size> [<8|16|32>]");
+        return;
+    }
+    if (!get_expression(&args, &bits))
+        bits = 32;
+
+    int wordsize;
+    switch (bits) {
+    case 8:
+        wordsize = MO_SIZE8;
+        break;
+    case 16:
+        wordsize = MO_SIZE16;
+        break;
+    case 32:
+        wordsize = MO_SIZE32;
+        break;
+    default:
+        ScriptError("Column size must be 8, 16 or 32");
         return;
     }
 
     alignMemAddr(&addr);
+    // Only whole columns are shown.
+    size = (size + (1 << wordsize) - 1) & ~((1 << wordsize) - 1);
 
     if (virt)
-        memDump((uint8 *)addr, size);
+        memDump((uint8 *)addr, size, wordsize);
     else
-        memPhysDump(addr, size);
+        memPhysDump(addr, size, wordsize);
 }
 REG_CMD_ALT(0, "VD|UMP", cmd_memaccess, vdump, 0)
 REG_CMD(0, "PD|UMP", cmd_memaccess,
-        "[V|P]DUMP <addr> <size>\n"
+        "[V|P]DUMP <addr> <size> [<8|16|32>]\n"
         "  Dump an area of memory in hexadecimal/char format from\n"
-        "  given [V]irtual or [P]hysical address.")
+        "  given [V]irtual or [P]hysical address, in 8, 16 or 32\n"
+        "  (default) bit columns.  Repeated lines are shown as '*'\n"
+        "  unless DUMPSKIP is 0.")
+
+
+/****************************************************************
+ * Searching memory
+ ****************************************************************/
+
+static uint32 SearchHitCount;
+static uint32 SearchHits[64];
+REG_VAR_INTLIST(0, "SEARCHHITS", &SearchHitCount, SearchHits,
+                "Addresses found by the last [P|V]SEARCH")
+
+static void
+searchHit(struct searchPattern *sp, uint32 addr)
+{
+    Output("Match at %08x", addr);
+    if (sp->count < ARRAY_SIZE(SearchHits))
+        SearchHits[sp->count] = addr;
+    sp->count++;
+}
+
+static void
+searchProgress(uint32 done)
+{
+    SetProgress(done / PHYS_CACHE_SIZE);
+}
+
+// Copy virtual memory a page at a time - returns the number of bytes
+// copied before an exception occurred.
+static uint32
+memVirtReadBlock(void *dst, uint32 vaddr, uint32 len)
+{
+    uint32 done = 0;
+    while (done < len) {
+        uint32 sz = PAGE_SIZE - ((vaddr + done) & (PAGE_SIZE - 1));
+        if (sz > len - done)
+            sz = len - done;
+        bool ok = true;
+        TRY_EXCEPTION_HANDLER {
+            memcpy((uint8 *)dst + done, (void *)(vaddr + done), sz);
+        } CATCH_EXCEPTION_HANDLER {
+            ok = false;
+        }
+        if (!ok)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+// Search 'size' bytes of memory at 'start' for a pattern.
+static void
+memSearch(struct searchPattern *sp, bool virt, uint32 start, uint32 size)
+{
+    uint8 *buf = (uint8 *)malloc(PHYS_CACHE_SIZE);
+    if (!buf) {
+        Output(C_ERROR "Failed to allocate buffer");
+        return;
+    }
+    sp->hit = searchHit;
+    if (!virt)
+        memPhysReadSync();
+    InitProgress(DLG_PROGRESS, (size + PHYS_CACHE_MASK) / PHYS_CACHE_SIZE);
+    uint32 done = searchRange(sp, start, size, buf, PHYS_CACHE_SIZE
+                              , virt ? memVirtReadBlock : memPhysReadBlock
+                              , searchProgress);
+    DoneProgress();
+    free(buf);
+    if (done != size)
+        Output(C_ERROR "Unable to read address %08x", start + done);
+
+    SearchHitCount = (sp->count < ARRAY_SIZE(SearchHits)
+                      ? sp->count : ARRAY_SIZE(SearchHits));
+    Output("%d matches found", sp->count);
+}
+
+// Parse a comma separated list of expressions.
+static int
+getWordList(const char **args, uint32 *list, uint32 max)
+{
+    uint32 n = 0;
+    for (;;) {
+        if (n >= max) {
+            ScriptError("Pattern too long");
+            return -1;
+        }
+        if (!get_expression(args, &list[n]))
+            return n;
+        n++;
+        while (isspace(**args))
+            (*args)++;
+        if (**args != ',')
+            return n;
+        (*args)++;
+    }
+}
+
+static void
+cmd_memsearch(const char *tok, const char *args)
+{
+    bool virt = toupper(tok[0]) == 'V';
+    uint32 addr, size;
+    if (!get_expression(&args, &addr) || !get_expression(&args, &size)) {
+        ScriptError("Expected <addr> <size> <pattern> [<mask>]");
+        return;
+    }
+
+    struct searchPattern *sp = (struct searchPattern *)calloc(1, sizeof(*sp));
+    if (!sp) {
+        Output(C_ERROR "Failed to allocate buffer");
+        return;
+    }
+    while (isspace(*args))
+        args++;
+    if (*args == '"' || *args == '\'') {
+        char str[MAX_CMDLEN];
+        get_token(&args, str, sizeof(str));
+        sp->len = strlen(str);
+        if (!sp->len || sp->len > SEARCH_MAXPAT) {
+            ScriptError("String must be 1 to %d characters", SEARCH_MAXPAT);
+            goto out;
+        }
+        memcpy(sp->bytes, str, sp->len);
+    } else {
+        int count = getWordList(&args, sp->words, ARRAY_SIZE(sp->words));
+        if (count <= 0) {
+            if (!count)
+                ScriptError("Expected <pattern>");
+            goto out;
+        }
+        int masks = getWordList(&args, sp->masks, ARRAY_SIZE(sp->masks));
+        if (masks < 0)
+            goto out;
+        if (masks > 1 && masks != count) {
+            ScriptError("Expected one mask or one mask per pattern word");
+            goto out;
+        }
+        for (int i = 0; i < count; i++) {
+            if (masks <= 1)
+                sp->masks[i] = masks ? sp->masks[0] : 0xffffffff;
+            sp->words[i] &= sp->masks[i];
+        }
+        sp->isWord = 1;
+        sp->len = count * 4;
+        alignMemAddr(&addr);
+    }
+
+    memSearch(sp, virt, addr, size);
+out:
+    free(sp);
+}
+REG_CMD_ALT(0, "VSEARCH", cmd_memsearch, vsearch, 0)
+REG_CMD(0, "PSEARCH", cmd_memsearch,
+        "[V|P]SEARCH <addr> <size> <word>[,<word>...] [<mask>[,<mask>...]]\n"
+        "[V|P]SEARCH <addr> <size> \"<string>\"\n"
+        "  Search an area of [V]irtual or [P]hysical memory for a list of\n"
+        "  (masked) words at word aligned addresses, or for a string at\n"
+        "  any address.  The first matches are stored in SEARCHHITS.")
 
 
 /****************************************************************
@@ -144,47 +493,22 @@ REG_CMD(0, "PD|UMP", cmd_memaccess,
 // Fill given number of words in virtual memory with given value
 static void memFill(uint8 *vaddr, uint32 wcount, uint32 value, int wordsize)
 {
-    TRY_EXCEPTION_HANDLER {
-        switch (wordsize) {
-        case MO_SIZE8:
-            while (wcount--) {
-                *(uint8*)vaddr = value;
-                vaddr += 1;
-            }
-            break;
-        case MO_SIZE16:
-            while (wcount--) {
-                *(uint16*)vaddr = value;
-                vaddr += 2;
-            }
-            break;
-        default:
-            while (wcount--) {
-                *(uint32*)vaddr = value;
-                vaddr += 4;
-            }
-            break;
-        }
-    } CATCH_EXCEPTION_HANDLER {
+    struct fillPattern pat;
+    fillPatternInit(&pat, wordsize, value);
+    if (!memFillBlock(vaddr, wcount << wordsize, &pat))
         Output(C_ERROR "EXCEPTION while writing %08x to address %p",
                value, vaddr);
-    }
 }
 
 // Fill given number of words in physical memory with given value
 void memPhysFill(uint32 paddr, uint32 wcount, uint32 value, int wordsize)
 {
-  while (wcount)
-  {
-    uint8 *vaddr = memPhysMap (paddr);
-    // We are guaranteed to have 32K ahead
-    uint32 words = (32 * 1024) >> wordsize;
-    if (words > wcount)
-      words = wcount;
-    memFill (vaddr, words, value, wordsize);
-    wcount -= words;
-    paddr += words << wordsize;
-  }
+    struct fillPattern pat;
+    fillPatternInit(&pat, wordsize, value);
+    uint32 len = wcount << wordsize;
+    uint32 done = memPhysFillBlock(paddr, len, &pat);
+    if (done < len)
+        Output(C_ERROR "Unable to write physical address %08x", paddr + done);
 }
 
 static void
@@ -231,6 +555,62 @@ REG_CMD(0, "PFW", cmd_memfill,
         "  The [B]yte/[H]alfword/[W]ord suffixes selects the size of\n"
         "  <value> and in which units the <count> is measured.")
 
+static void
+cmd_memfillpat(const char *tok, const char *args)
+{
+    uint32 addr, count;
+    char size[MAX_CMDLEN];
+    if (!get_expression(&args, &addr) || !get_expression(&args, &count)
+        || get_token(&args, size, sizeof(size))) {
+        ScriptError("Expected <addr> <count> <B|H|W> <pattern> [<step>]");
+        return;
+    }
+    struct fillPattern pat;
+    memset(&pat, 0, sizeof(pat));
+    switch (toupper(size[0])) {
+    case 'B': pat.wordsize = MO_SIZE8; break;
+    case 'H': pat.wordsize = MO_SIZE16; break;
+    case 'W': pat.wordsize = MO_SIZE32; break;
+    default:
+        ScriptError("Unknown element size '%s'", size);
+        return;
+    }
+
+    const char *p = args;
+    char word[MAX_CMDLEN];
+    if (!get_token(&p, word, sizeof(word)) && !_stricmp(word, "ADDR")) {
+        pat.addrdata = 1;
+        args = p;
+    } else {
+        int n = getWordList(&args, pat.values, ARRAY_SIZE(pat.values));
+        if (n <= 0) {
+            if (!n)
+                ScriptError("Expected <pattern>");
+            return;
+        }
+        pat.count = n;
+        get_expression(&args, &pat.step);
+    }
+
+    uint32 len = count << pat.wordsize;
+    if (toupper(tok[0]) == 'V') {
+        if (!memFillBlock((uint8*)addr, len, &pat))
+            Output(C_ERROR "EXCEPTION while filling memory at %08x", addr);
+        return;
+    }
+    uint32 done = memPhysFillBlock(addr, len, &pat);
+    if (done < len)
+        Output(C_ERROR "Unable to write physical address %08x", addr + done);
+}
+REG_CMD_ALT(0, "VFILLPAT", cmd_memfillpat, vfillpat, 0)
+REG_CMD(0, "PFILLPAT", cmd_memfillpat,
+        "[V|P]FILLPAT <addr> <count> <B|H|W> <pattern> [<step>]\n"
+        "  Fill <count> bytes, halfwords or words of [V]irtual or\n"
+        "  [P]hysical memory with a repeating pattern.  <pattern> is a\n"
+        "  comma separated list of values; <step> is added to all of\n"
+        "  them after each repeat.  A <pattern> of ADDR stores the\n"
+        "  address of each element instead.")
+
 /****************************************************************
  * Writing or clearing bits to memory
  ****************************************************************/
@@ -256,8 +636,15 @@ setbitVirt(uint8 *vaddr, uint32 bitnr, uint32 bitval)
 static void
 setbitPhys(uint32 paddr, uint32 bitnr, uint32 bitval)
 {
-  uint8 *vaddr = memPhysMap(paddr);
+  struct physMapping pm;
+  uint8 *vaddr = memPhysMapRange(&pm, paddr, 4);
+  if (!vaddr)
+  {
+    Output(C_ERROR "Unable to map physical address %08x", paddr);
+    return;
+  }
   setbitVirt(vaddr, bitnr, bitval);
+  memPhysUnmap(&pm);
 }
 
 
@@ -296,53 +683,232 @@ REG_CMD(0, "SETBITP", cmd_setbit,
  * Dumping memory directly to file
  ****************************************************************/
 
-static bool memWrite (FILE *f, uint32 addr, uint32 size)
+// Size and number of the buffers used when dumping memory to a file
+#define FILEDUMP_BUFSIZE (256 * 1024)
+#define FILEDUMP_BUFS 2
+
+// A dump to file in progress.  The command's thread fills the buffers
+// from memory while a writer thread hands full ones to WriteFile.
+struct fileDump {
+    HANDLE file;
+    uint8 *buf[FILEDUMP_BUFS];
+    uint32 len[FILEDUMP_BUFS];
+    // Signalled when a buffer has been filled / written out
+    HANDLE full[FILEDUMP_BUFS], empty[FILEDUMP_BUFS];
+    volatile int failed;
+};
+
+// Writer thread - a buffer with zero length ends the dump.
+static DWORD
+fileDumpWriter(struct fileDump *fd)
 {
-  while (size)
-  {
-    uint32 wc, sz = (size > 0x1000) ? 0x1000 : size;
-    TRY_EXCEPTION_HANDLER
-    {
-      wc = fwrite ((void *)addr, 1, sz, f);
+    for (int i = 0; ; i = (i + 1) % FILEDUMP_BUFS) {
+        WaitForSingleObject(fd->full[i], INFINITE);
+        if (!fd->len[i])
+            break;
+        DWORD nw;
+        if (!fd->failed
+            && (!WriteFile(fd->file, fd->buf[i], fd->len[i], &nw, NULL)
+                || nw != fd->len[i]))
+            fd->failed = 1;
+        SetEvent(fd->empty[i]);
     }
-    CATCH_EXCEPTION_HANDLER
-    {
-      wc = 0;
-      Output(C_ERROR "Exception caught!");
+    return 0;
+}
+
+// Write a portion of memory to file
+static bool memWriteFile(const char *fn, bool virt, uint32 addr, uint32 size)
+{
+    struct fileDump fd;
+    memset(&fd, 0, sizeof(fd));
+    wchar_t wfn[MAX_CMDLEN];
+    mbstowcs(wfn, fn, ARRAY_SIZE(wfn));
+    fd.file = CreateFile(wfn, GENERIC_WRITE, FILE_SHARE_READ, NULL
+                         , CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fd.file == INVALID_HANDLE_VALUE) {
+        Output(C_ERROR "Cannot write file %s", fn);
+        return false;
     }
 
-    if (wc != sz)
-    {
-      Output(C_ERROR "Short write detected while writing to file");
-      fclose (f);
-      return false;
+    bool ok = true;
+    HANDLE thread = NULL;
+    for (int i = 0; i < FILEDUMP_BUFS; i++) {
+        fd.buf[i] = (uint8 *)malloc(FILEDUMP_BUFSIZE);
+        fd.full[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        fd.empty[i] = CreateEvent(NULL, FALSE, TRUE, NULL);
+        if (!fd.buf[i] || !fd.full[i] || !fd.empty[i])
+            ok = false;
     }
-    addr += sz;
-    size -= sz;
-  }
-  return true;
+    if (ok)
+        thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)fileDumpWriter
+                              , &fd, 0, NULL);
+    if (!thread) {
+        Output(C_ERROR "Failed to allocate buffer");
+        ok = false;
+    } else {
+        uint32 done = 0, start = GetTickCount();
+        int i = 0, owned = 0;
+        if (!virt)
+            memPhysReadSync();
+        InitProgress(DLG_PROGRESS, size);
+        while (done < size) {
+            WaitForSingleObject(fd.empty[i], INFINITE);
+            owned = 1;
+            if (fd.failed)
+                break;
+            uint32 sz = size - done;
+            if (sz > FILEDUMP_BUFSIZE)
+                sz = FILEDUMP_BUFSIZE;
+            uint32 got = (virt ? memVirtReadBlock(fd.buf[i], addr + done, sz)
+                          : memPhysReadBlock(fd.buf[i], addr + done, sz));
+            done += got;
+            if (got) {
+                fd.len[i] = got;
+                SetEvent(fd.full[i]);
+                owned = 0;
+                i = (i + 1) % FILEDUMP_BUFS;
+            }
+            if (got != sz) {
+                Output(C_ERROR "Unable to read address %08x", addr + done);
+                ok = false;
+                break;
+            }
+            SetProgress(done);
+            uint32 ms = GetTickCount() - start;
+            if (ms)
+                SetProgressText("%d of %d KB, %d KB/s"
+                                , done / 1024, size / 1024
+                                , (uint32)(done * 1000ULL / ms / 1024));
+        }
+        // Let the writer finish the pending buffers and exit.
+        if (!owned)
+            WaitForSingleObject(fd.empty[i], INFINITE);
+        fd.len[i] = 0;
+        SetEvent(fd.full[i]);
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        DoneProgress();
+
+        uint32 ms = GetTickCount() - start;
+        if (fd.failed) {
+            Output(C_ERROR "Short write detected while writing to file");
+            ok = false;
+        } else if (ok) {
+            Output("Wrote %d bytes in %d ms (%d KB/s)", done, ms
+                   , ms ? (uint32)(done * 1000ULL / ms / 1024) : 0);
+        }
+    }
+
+    for (int i = 0; i < FILEDUMP_BUFS; i++) {
+        free(fd.buf[i]);
+        if (fd.full[i])
+            CloseHandle(fd.full[i]);
+        if (fd.empty[i])
+            CloseHandle(fd.empty[i]);
+    }
+    CloseHandle(fd.file);
+    return ok;
 }
 
-// Write a portion of physical memory to file
-static bool memPhysWriteFile (FILE *f, uint32 addr, uint32 size)
+// Sparse dump files (see tools/expand-sparsedump.py) hold a header,
+// an index entry for each page and then the contents of only those
+// pages that are not filled with a single repeated word.
+#define SPARSE_MAGIC "HRTSPRS1"
+struct sparseHeader {
+    char magic[8];
+    uint32 addr, size, pageSize, pages, dataPages;
+};
+struct sparseIndex {
+    // Position of the page in the data area (or SPARSE_UNIFORM /
+    // SPARSE_UNREADABLE)
+    uint32 data;
+    // Word repeated over the page (for SPARSE_UNIFORM pages)
+    uint32 fill;
+};
+#define SPARSE_UNIFORM 0xffffffff
+#define SPARSE_UNREADABLE 0xfffffffe
+
+// Check if the first 'words' words of 'p' are all the same.
+static bool
+pageUniform(const uint32 *p, uint32 words)
 {
-  while (size)
-  {
-    uint8 *vaddr = memPhysMap (addr);
-    // We are guaranteed to have 32K ahead
-    uint32 sz = size > 0x8000 ? 0x8000 : size;
-    if (!memWrite (f, (uint32)vaddr, sz))
-      return false;
-    size -= sz;
-    addr += sz;
-  }
-  return true;
+    uint32 v = p[0], i;
+    for (i = 0; i + 4 <= words; i += 4)
+        if ((p[i] ^ v) | (p[i+1] ^ v) | (p[i+2] ^ v) | (p[i+3] ^ v))
+            return false;
+    for (; i < words; i++)
+        if (p[i] != v)
+            return false;
+    return true;
+}
+
+// Write a portion of memory to file in the sparse format.
+static bool memWriteSparse(FILE *f, bool virt, uint32 addr, uint32 size)
+{
+    struct sparseHeader hdr;
+    memcpy(hdr.magic, SPARSE_MAGIC, sizeof(hdr.magic));
+    hdr.addr = addr;
+    hdr.size = size;
+    hdr.pageSize = PAGE_SIZE;
+    hdr.pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    hdr.dataPages = 0;
+    struct sparseIndex *index = (struct sparseIndex *)calloc(
+        hdr.pages, sizeof(*index));
+    if (!index) {
+        Output(C_ERROR "Failed to allocate buffer");
+        return false;
+    }
+
+    // The index is filled in once all the pages have been looked at.
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1
+               && fwrite(index, sizeof(*index), hdr.pages, f) == hdr.pages);
+    uint32 page[PAGE_SIZE / 4], uniform = 0, unreadable = 0;
+    if (!virt)
+        memPhysReadSync();
+    InitProgress(DLG_PROGRESS, hdr.pages);
+    for (uint32 i = 0; ok && i < hdr.pages; i++) {
+        SetProgress(i);
+        uint32 len = size - i * PAGE_SIZE;
+        if (len > PAGE_SIZE)
+            len = PAGE_SIZE;
+        else
+            memset(page, 0, sizeof(page));
+        uint32 a = addr + i * PAGE_SIZE;
+        uint32 got = (virt ? memVirtReadBlock(page, a, len)
+                      : memPhysReadBlock(page, a, len));
+        if (got != len) {
+            index[i].data = SPARSE_UNREADABLE;
+            unreadable++;
+        } else if (pageUniform(page, (len + 3) / 4)) {
+            index[i].data = SPARSE_UNIFORM;
+            index[i].fill = page[0];
+            uniform++;
+        } else {
+            index[i].data = hdr.dataPages++;
+            ok = fwrite(page, sizeof(page), 1, f) == 1;
+        }
+    }
+    DoneProgress();
+
+    if (ok)
+        ok = (!fseek(f, 0, SEEK_SET)
+              && fwrite(&hdr, sizeof(hdr), 1, f) == 1
+              && fwrite(index, sizeof(*index), hdr.pages, f) == hdr.pages);
+    free(index);
+    if (!ok) {
+        Output(C_ERROR "Short write detected while writing to file");
+        return false;
+    }
+    Output("Wrote %d of %d pages (%d uniform, %d unreadable)"
+           , hdr.dataPages, hdr.pages, uniform, unreadable);
+    return true;
 }
 
 static void
 cmd_memtofile(const char *tok, const char *args)
 {
     bool virt = toupper (tok [0]) == 'V';
+    bool sparse = toupper (tok [3]) == 'S';
     char rawfn[MAX_CMDLEN], fn[MAX_CMDLEN];
     if (get_token(&args, rawfn, sizeof(rawfn))) {
         ScriptError("file name expected");
@@ -356,23 +922,29 @@ cmd_memtofile(const char *tok, const char *args)
     }
 
     fnprepare(rawfn, fn, sizeof(fn));
+    if (!sparse) {
+        memWriteFile(fn, virt, addr, size);
+        return;
+    }
+
     FILE *f = fopen(fn, "wb");
     if (!f) {
         Output(C_ERROR "Cannot write file %s", fn);
         return;
     }
-
-    if (virt)
-        memWrite(f, addr, size);
-    else
-        memPhysWriteFile(f, addr, size);
-
+    memWriteSparse(f, virt, addr, size);
     fclose(f);
 }
 REG_CMD_ALT(0, "PWF", cmd_memtofile, pwf, 0)
+REG_CMD_ALT(0, "PWFS", cmd_memtofile, pwfs, 0)
+REG_CMD_ALT(0, "VWFS", cmd_memtofile, vwfs, 0)
 REG_CMD(0, "VWF", cmd_memtofile,
-        "[V|P]WF <filename> <addr> <size>\n"
-        "  Write a portion of [V]irtual or [P]hysical memory to given file.")
+        "[V|P]WF[S] <filename> <addr> <size>\n"
+        "  Write a portion of [V]irtual or [P]hysical memory to given file.\n"
+        "  With the [S] suffix a sparse file is written - pages filled\n"
+        "  with a single repeated word (eg, unused RAM or erased flash)\n"
+        "  are only recorded in an index.  Use tools/expand-sparsedump.py\n"
+        "  to turn it back into a flat image.")
 
 
 /****************************************************************
@@ -384,45 +956,243 @@ DEF_GETCPR(get_p15r2, p15, 0, c2, c0, 0)
 DEF_GETCPR(get_p15r3, p15, 0, c3, c0, 0)
 DEF_GETCPR(get_p15r13, p15, 0, c13, c0, 0)
 
+// Number of pages holding L2 tables that are kept during a walk
+#define MMU_L2CACHE 16
+
+struct l2CachePage {
+    uint32 paddr;
+    uint32 data[PAGE_SIZE / 4];
+};
+
+// State of a walk over the mmu tables.  Consecutive mappings that
+// continue each other (same type and flags, virtually and physically
+// adjacent) are collected into a single range line.
+struct mmuWalk {
+    uint32 l1only, showall, start, size;
+    // Copies of L2 table pages (NULL to always read them)
+    struct l2CachePage *l2cache;
+    uint32 l2next;
+    // Domain of the current L1 entry
+    uint32 domain;
+    // The pending range
+    int level;
+    uint32 vaddr, paddr, len, flags, rdomain;
+    const struct pageinfo *pi;
+    int lines;
+    // Export the ranges as records (to 'out', as csv lines or into
+    // the 'recs' array)
+    int exporting, csv;
+    FILE *out;
+    struct mmuMapRecord *recs;
+    uint32 maxrecs, lost;
+};
+
+void
+printMMUHeader()
+{
+    Output("      Virtual      | Physical |   Description |  Flags");
+    Output("      address      | address  |               |");
+    Output("-------------------+----------+---------------+----------------------");
+}
+
+// Return the 'count' descriptors of the L2 table at 'paddr'.
+static const uint32 *
+mmuReadL2(struct mmuWalk *w, uint32 paddr, uint32 count, uint32 *buf)
+{
+    uint32 page = paddr & ~(PAGE_SIZE - 1), got;
+    if (!w->l2cache) {
+        got = memPhysReadBlock(buf, paddr, count * 4);
+        for (uint32 d = got / 4; d < count; d++)
+            buf[d] = 0xffffffff;
+        return buf;
+    }
+    // Several L1 entries often use tables in the same page.
+    struct l2CachePage *c;
+    for (uint32 i = 0; i < MMU_L2CACHE; i++) {
+        c = &w->l2cache[i];
+        if (c->paddr == page)
+            return &c->data[(paddr - page) / 4];
+    }
+    c = &w->l2cache[w->l2next++ % MMU_L2CACHE];
+    got = memPhysReadBlock(c->data, page, PAGE_SIZE);
+    for (uint32 d = got / 4; d < PAGE_SIZE / 4; d++)
+        c->data[d] = 0xffffffff;
+    c->paddr = page;
+    return &c->data[(paddr - page) / 4];
+}
+
+// Write the pending range as a DUMP MMUMAP record.
 static void
-memDumpMMU(const char *tok, const char *args)
+mmuExport(struct mmuWalk *w)
 {
-    uint32 l1only = 0, showall = 1, start = 0, size = 0;
-    if (get_expression(&args, &l1only) && get_expression(&args, &start)) {
-        size = 1;
-        get_expression(&args, &size);
-        showall = 0;
+    if (!w->pi->isMapped)
+        return;
+    struct mmuMapRecord r = {
+        w->vaddr, w->paddr, w->len, w->level, w->flags, w->rdomain };
+    if (w->maxrecs) {
+        if ((uint32)w->lines >= w->maxrecs) {
+            struct mmuMapRecord *n = (struct mmuMapRecord *)realloc(
+                w->recs, w->maxrecs * 2 * sizeof(r));
+            if (!n) {
+                w->lost++;
+                return;
+            }
+            w->recs = n;
+            w->maxrecs *= 2;
+        }
+        w->recs[w->lines++] = r;
+        return;
     }
-    if (l1only != 1)
-        l1only = 0;
+    if (w->csv) {
+        char line[96];
+        _snprintf(line, sizeof(line), "%08x,%08x,%08x,%s,%d,%08x,%d"
+                  , w->vaddr, w->paddr, w->len, w->pi->name
+                  , w->level, w->flags, w->rdomain);
+        if (w->out)
+            fprintf(w->out, "%s\n", line);
+        else
+            Output("%s", line);
+    } else {
+        fwrite(&r, sizeof(r), 1, w->out);
+    }
+    w->lines++;
+}
 
-    Output("----- Virtual address map -----");
-    Output(" cp15: r1=%08x r2=%08x r3=%08x r13=%08x\n"
-           , get_p15r1(), get_p15r2(), get_p15r3(), get_p15r13());
-    Output(
-        "Descriptor flags legend:\n"
-        "  C: Cacheable    B: Bufferable     D: Domain #\n"
-        " AP: Access Permissions (for up to 4 slices):\n"
-        "       0: No Access             1: Supervisor mode read/write\n"
-        "       2: User mode read        3: User mode read/write");
-    if (Mach->arm6mmu) {
-        Output(
-        "       4: Reserved              5: Supervisor mode read only\n"
-        "       6: Supervisor/user read  7: Supervisor/user read\n"
-        " XN: No execute   P: ECC enabled   nG: Not-Global\n"
-        "  S: Shared       T: 'TEX' code\n"
-            );
+// Print the pending range.
+static void
+mmuFlush(struct mmuWalk *w)
+{
+    if (!w->len)
+        return;
+    if (w->exporting) {
+        mmuExport(w);
+        w->len = 0;
+        return;
     }
+    uint32 vend = w->vaddr + w->len - 1;
+    if (!w->pi->isMapped) {
+        Output(w->level == 1 ? "%08x-%08x  |          | %13s |"
+               : " %08x-%08x |          | %13s |"
+               , w->vaddr, vend, w->pi->name);
+    } else {
+        char flagbuf[64];
+        w->pi->flagfunc(flagbuf, w->flags);
+        Output(w->level == 1 ? "%08x-%08x  | %08x | %13s |%s"
+               : " %08x-%08x | %08x | %13s |%s"
+               , w->vaddr, vend, w->paddr, w->pi->name, flagbuf);
+    }
+    w->lines++;
+    w->len = 0;
+}
 
-    uint32 mmu = cpuGetMMU();
+// Add a mapping of 'len' bytes at 'vaddr' to the walk.
+static void
+mmuAdd(struct mmuWalk *w, int level, uint32 vaddr, uint32 paddr, uint32 len
+       , const struct pageinfo *pi, uint32 flags)
+{
+    if (w->len && w->level == level && w->vaddr + w->len == vaddr
+        && (pi->isMapped
+            ? (pi == w->pi && flags == w->flags && w->domain == w->rdomain
+               && w->paddr + w->len == paddr)
+            : !w->pi->isMapped)) {
+        w->len += len;
+        return;
+    }
+    mmuFlush(w);
+    w->level = level;
+    w->vaddr = vaddr;
+    w->paddr = paddr;
+    w->len = len;
+    w->pi = pi;
+    w->flags = flags;
+    w->rdomain = w->domain;
+}
+
+//mb=entry no, l1d=l1 descriptor (the entry), pL1 = previous L1
+static void
+mmuWalkL1(struct mmuWalk *w, uint32 mb, uint32 l1d, uint32 pL1)
+{
+    uint32 vaddr = mb << 20;
+    const struct pageinfo *pi = getL1Desc(l1d);
+    if (! pi->isMapped) {
+        if (w->showall)
+            mmuAdd(w, 1, vaddr, 0, 1 << 20, pi, 0);
+        return;
+    }
+    uint32 flags = l1d & ~pi->mask;
+    w->domain = (l1d & MMU_L1_DOMAIN_MASK) >> MMU_L1_DOMAIN_SHIFT;
+    if (pi->mask == MMU_L1_SUPER_SECTION_MASK)
+        // Super sections are always in domain 0
+        w->domain = 0;
+    if (! pi->L2MapShift) {
+        // Sections (and the 16 copies of a super section) step through
+        // physical memory a megabyte at a time.
+        uint32 paddr = (l1d & pi->mask) | (vaddr & ~pi->mask);
+        if (w->showall || RANGES_OVERLAP(w->start, w->size, paddr, 1 << 20))
+            mmuAdd(w, 1, vaddr, paddr, 1 << 20, pi, flags);
+        return;
+    }
+    if (w->showall && !w->exporting
+        && (getL1Desc(pL1) != pi || (pL1 & ~pi->mask) != flags)) {
+        // Start of a block of L2 tables with new domain/flags
+        mmuFlush(w);
+        char flagbuf[64];
+        pi->flagfunc(flagbuf, flags);
+        Output("%08x           |          | %13s |%s", vaddr, pi->name, flagbuf);
+        w->lines++;
+    }
 
-    Output("  Virtual | Physical |   Description |  Flags");
-    Output("  address | address  |               |");
-    Output("----------+----------+---------------+----------------------");
+    if (w->l1only)
+        return;
+
+    // Walk the 2nd level descriptor table
+    uint32 shift = pi->L2MapShift, count = 1 << (20 - shift);
+    uint32 buf[1024];
+    const uint32 *l2table = mmuReadL2(w, l1d & pi->mask, count, buf);
+    for (uint32 d = 0; d < count; d++) {
+        uint32 l2d = l2table[d];
+        uint32 l2vaddr = vaddr + (d << shift);
+        const struct pageinfo *pi2 = getL2Desc(l2d);
+        if (!pi2->isMapped) {
+            if (w->showall)
+                mmuAdd(w, 2, l2vaddr, 0, 1 << shift, pi2, 0);
+            continue;
+        }
+        uint32 l2paddr = (l2d & pi2->mask) | (l2vaddr & ~pi2->mask);
+        if (w->showall
+            || RANGES_OVERLAP(w->start, w->size, l2paddr, 1 << shift))
+            mmuAdd(w, 2, l2vaddr, l2paddr, 1 << shift, pi2, l2d & ~pi2->mask);
+    }
+}
+
+// Walk the whole mmu table (as pointed to by the mmu register).
+static int
+mmuWalkTable(struct mmuWalk *w)
+{
+    // Take a copy of the whole 1st level table up front
+    uint32 mmu = cpuGetMMU();
+    uint32 *l1table = (uint32*)malloc(4096 * 4);
+    if (!l1table) {
+        Output(C_ERROR "Failed to allocate buffer");
+        return -1;
+    }
+    memPhysReadSync();
+    if (memPhysReadBlock(l1table, mmu, 4096 * 4) != 4096 * 4) {
+        Output(C_ERROR "Unable to read mmu table at %08x", mmu);
+        free(l1table);
+        return -1;
+    }
+    // Without a cache every L2 table is simply read when needed.
+    w->l2cache = (struct l2CachePage *)malloc(
+        MMU_L2CACHE * sizeof(*w->l2cache));
+    if (w->l2cache)
+        for (int i = 0; i < MMU_L2CACHE; i++)
+            w->l2cache[i].paddr = 1;
 
     // Walk down the 1st level descriptor table
     InitProgress(DLG_PROGRESS, 0x1000);
     uint mb = 0;
+    int ret = 0;
     TRY_EXCEPTION_HANDLER {
         uint32 pL1, l1d = 0xffffffff;
         for (mb = 0; mb < 0x1000; mb++) {
@@ -430,86 +1200,227 @@ memDumpMMU(const char *tok, const char *args)
             pL1 = l1d;
 
             // Read 1st level descriptor
-            l1d = memPhysRead(mmu + mb * 4);
+            l1d = l1table[mb];
 
-            parseL1Entry(mb, l1d, pL1, l1only, showall, start, size);
+            mmuWalkL1(w, mb, l1d, pL1);
         }
+        mmuFlush(w);
     } CATCH_EXCEPTION_HANDLER {
         Output(C_ERROR "EXCEPTION CAUGHT AT MEGABYTE %d!", mb);
+        ret = -1;
     }
 
-    if (showall)
-        Output("End of virtual address space");
     DoneProgress();
+    free(w->l2cache);
+    w->l2cache = NULL;
+    free(l1table);
+    return ret;
+}
+
+static void
+memDumpMMU(const char *tok, const char *args)
+{
+    struct mmuWalk w;
+    memset(&w, 0, sizeof(w));
+    w.showall = 1;
+    if (get_expression(&args, &w.l1only) && get_expression(&args, &w.start)) {
+        w.size = 1;
+        get_expression(&args, &w.size);
+        w.showall = 0;
+    }
+    if (w.l1only != 1)
+        w.l1only = 0;
+
+    Output("----- Virtual address map -----");
+    Output(" cp15: r1=%08x r2=%08x r3=%08x r13=%08x\n"
+           , get_p15r1(), get_p15r2(), get_p15r3(), get_p15r13());
+    Output(
+        "Descriptor flags legend:\n"
+        "  C: Cacheable    B: Bufferable     D: Domain #\n"
+        " AP: Access Permissions (for up to 4 slices):\n"
+        "       0: No Access             1: Supervisor mode read/write\n"
+        "       2: User mode read        3: User mode read/write");
+    if (Mach->arm6mmu) {
+        Output(
+        "       4: Reserved              5: Supervisor mode read only\n"
+        "       6: Supervisor/user read  7: Supervisor/user read\n"
+        " XN: No execute   P: ECC enabled   nG: Not-Global\n"
+        "  S: Shared       T: 'TEX' code\n"
+            );
+    }
+
+    printMMUHeader();
+    mmuWalkTable(&w);
+
+    if (w.showall)
+        Output("End of virtual address space");
 }
 
 //mb=entry no, l1d=l1 descriptor (the entry), pL1 = previous L1
 //l1only=don't parse L2, start:size is what to look for (phys)
 int parseL1Entry(uint32 mb, uint32 l1d, uint32 pL1,
                     uint32 l1only, uint32 showall, uint32 start, uint32 size ){
-    int linesOut = 0; //no. lines outputted
-    uint32 vaddr=mb<<20;
-    const struct pageinfo *pi = getL1Desc(l1d);
-    uint32 paddr = l1d & pi->mask;
-    char flagbuf[64];
-    pi->flagfunc(flagbuf, l1d & ~pi->mask);
-    if (! pi->isMapped) {
-        if (showall && (l1d ^ pL1) & MMU_L1_TYPE_MASK){
-            Output("%08x  |          | %13s |", vaddr, pi->name);
-            linesOut++;
-        }
-        return linesOut;
+    struct mmuWalk w;
+    memset(&w, 0, sizeof(w));
+    w.l1only = l1only;
+    w.showall = showall;
+    w.start = start;
+    w.size = size;
+    mmuWalkL1(&w, mb, l1d, pL1);
+    mmuFlush(&w);
+    return w.lines;
+}
+REG_DUMP(0, "MMU", memDumpMMU,
+         "MMU [<1|2> [<start> [<size>]]] \n"
+         "  Show virtual memory map (4Gb address space). One may give an\n"
+         "  optional argument to trim output to the l1 tables. If <start>\n"
+         "  and <size> are specified, only those mappings within the\n"
+         "  physical address range are shown.")
+
+static void
+memDumpMMUMap(const char *tok, const char *args)
+{
+    struct mmuWalk w;
+    memset(&w, 0, sizeof(w));
+    w.showall = 1;
+    w.exporting = 1;
+
+    char fn[MAX_CMDLEN], vn[MAX_CMDLEN];
+    if (get_token(&args, vn, sizeof(vn))) {
+        // No file - list csv lines on the output.
+        w.csv = 1;
+        Output("vaddr,paddr,size,type,level,flags,domain");
+        mmuWalkTable(&w);
+        return;
     }
-    if (! pi->L2MapShift) {
-        if (showall
-            || RANGES_OVERLAP(start, size, paddr, ~pi->mask + 1)){
-            Output("%08x  | %08x | %13s |%s"
-           , vaddr, paddr, pi->name, flagbuf);
-            linesOut++;
+    if (!get_token(&args, fn, sizeof(fn))) {
+        if (_stricmp(fn, "CSV")) {
+            ScriptError("Expected [<filename> [CSV]]");
+            return;
         }
-        return linesOut;
+        w.csv = 1;
     }
-    if (showall){
-        Output("%08x  |          | %13s |%s", vaddr, pi->name, flagbuf);
-        linesOut++;
+    fnprepare(vn, fn, sizeof(fn));
+    w.out = fopen(fn, w.csv ? "w" : "wb");
+    if (!w.out) {
+        Output(C_ERROR "Cannot open file %s for writing", fn);
+        return;
+    }
+    if (w.csv) {
+        fprintf(w.out, "vaddr,paddr,size,type,level,flags,domain\n");
+    } else {
+        struct mmuMapHeader h;
+        memcpy(h.magic, MMUMAP_MAGIC, sizeof(h.magic));
+        h.mmu = cpuGetMMU();
+        h.arch = ((Mach->arm6mmu ? MMUMAP_ARM6MMU : 0)
+                  | (Arm6NoSubPages ? MMUMAP_NOSUBPAGES : 0));
+        fwrite(&h, sizeof(h), 1, w.out);
+    }
+    int ret = mmuWalkTable(&w);
+    if (ferror(w.out)) {
+        Output(C_ERROR "Short write detected while writing to file");
+        ret = -1;
     }
+    fclose(w.out);
+    if (!ret)
+        Output("Wrote %d mapped ranges to %s", w.lines, fn);
+}
+REG_DUMP(0, "MMUMAP", memDumpMMUMap,
+         "MMUMAP [<filename> [CSV]]\n"
+         "  Export the mapped ranges of the mmu table (vaddr, paddr, size,\n"
+         "  type, flags, domain).  Without a filename csv lines are shown,\n"
+         "  otherwise a binary table (or csv) is written for the host\n"
+         "  tool built with \"make mmumap\".")
+
+static int
+cmpMapPaddr(const void *a, const void *b)
+{
+    uint32 x = ((const struct mmuMapRecord *)a)->paddr;
+    uint32 y = ((const struct mmuMapRecord *)b)->paddr;
+    return x < y ? -1 : x > y;
+}
 
-    if (l1only)
-        return linesOut;
+static void
+cmd_aliases(const char *cmd, const char *args)
+{
+    uint32 paddr, size = 1;
+    if (!get_expression(&args, &paddr)) {
+        ScriptError("Expected <paddr> [<size>]");
+        return;
+    }
+    get_expression(&args, &size);
+    if (!size)
+        size = 1;
 
-    // Walk the 2nd level descriptor table
-    uint l2_count = 1 << (20 - pi->L2MapShift);
-    uint32 pL2, l2d = 0xffffffff;
-    for (uint d = 0; d < l2_count; d++) {
-        pL2 = l2d;
-        l2d = memPhysRead(paddr + d * 4);
-	uint32 l2vaddr = vaddr + (d << pi->L2MapShift);
-        const struct pageinfo *pi2 = getL2Desc(l2d);
-        uint32 l2paddr = l2d & pi2->mask;
-        pi2->flagfunc(flagbuf, l2d & ~pi2->mask);
+    // Collect all mapped ranges and index them by physical address.
+    struct mmuWalk w;
+    memset(&w, 0, sizeof(w));
+    w.showall = 1;
+    w.exporting = 1;
+    w.maxrecs = 1024;
+    w.recs = (struct mmuMapRecord *)malloc(w.maxrecs * sizeof(w.recs[0]));
+    if (!w.recs) {
+        Output(C_ERROR "Failed to allocate buffer");
+        return;
+    }
+    mmuWalkTable(&w);
+    if (w.lost)
+        Output(C_WARN "Out of memory - %d ranges not searched", w.lost);
+    uint32 count = w.lines, maxsize = 0;
+    qsort(w.recs, count, sizeof(w.recs[0]), cmpMapPaddr);
+    for (uint32 i = 0; i < count; i++)
+        if (w.recs[i].size > maxsize)
+            maxsize = w.recs[i].size;
+
+    // Only ranges starting less than the largest range size before
+    // 'paddr' can overlap it.
+    uint32 first = paddr > maxsize ? paddr - maxsize : 0;
+    uint32 lo = 0, hi = count;
+    while (lo < hi) {
+        uint32 mid = (lo + hi) / 2;
+        if (w.recs[mid].paddr < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-        if (!pi2->isMapped) {
-            if (showall && (l2d ^ pL2) & MMU_L2_TYPE_MASK){
-                Output(" %08x |          | %13s |", l2vaddr, pi2->name);
-                linesOut++;
-            }
+    Output("      Virtual      | Physical |   Description | Dom | Flags");
+    uint32 found = 0;
+    uint64 end = (uint64)paddr + size;
+    for (uint32 i = lo; i < count && w.recs[i].paddr < end; i++) {
+        struct mmuMapRecord r = w.recs[i];
+        if (!RANGES_OVERLAP(paddr, size, r.paddr, r.size))
             continue;
+        // Only show the part of the range that maps the target.
+        if (r.paddr < paddr) {
+            r.vaddr += paddr - r.paddr;
+            r.size -= paddr - r.paddr;
+            r.paddr = paddr;
         }
-        if (showall
-            || RANGES_OVERLAP(start, size, l2paddr, 1<<pi->L2MapShift)){
-            Output(" %08x | %08x | %13s |%s"
-           , l2vaddr, l2paddr, pi2->name, flagbuf);
-            linesOut++;
+        if (r.paddr - paddr + r.size > size)
+            r.size = size - (r.paddr - paddr);
+        const struct pageinfo *pi;
+        uint32 flags = r.flags;
+        if (r.level == 1) {
+            pi = getL1Desc(flags);
+            // The domain has its own column.
+            flags &= ~MMU_L1_DOMAIN_MASK;
+        } else {
+            pi = getL2Desc(flags);
         }
+        char flagbuf[64];
+        pi->flagfunc(flagbuf, flags);
+        Output("%08x-%08x  | %08x | %13s | %3d |%s", r.vaddr
+               , r.vaddr + r.size - 1, r.paddr, pi->name, r.domain, flagbuf);
+        found++;
     }
-    return linesOut;
+    Output("%d virtual ranges map %08x-%08x", found, paddr, paddr + size - 1);
+    free(w.recs);
 }
-REG_DUMP(0, "MMU", memDumpMMU,
-         "MMU [<1|2> [<start> [<size>]]] \n"
-         "  Show virtual memory map (4Gb address space). One may give an\n"
-         "  optional argument to trim output to the l1 tables. If <start>\n"
-         "  and <size> are specified, only those mappings within the\n"
-         "  physical address range are shown.")
+REG_CMD(0, "ALIASES", cmd_aliases,
+        "ALIASES <paddr> [<size>]\n"
+        "  List every virtual range of the current mmu table that maps\n"
+        "  (part of) the given physical range, with its flags and domain.")
 
 
 /****************************************************************
@@ -548,11 +1459,22 @@ REG_CMD(0, "ALLOCTEST", allocTest,
 static uint32 memVar(int phys, int wordsize
                      , bool setval, uint32 *args, uint32 val)
 {
-    uint8 *vaddr;
-    if (phys)
-        vaddr = memPhysMap(args[0]);
-    else
-        vaddr = (uint8*)args[0];
+    if (phys) {
+        struct physMapping pm;
+        uint8 *vaddr = memPhysMapRange(&pm, args[0], 1 << wordsize);
+        if (!vaddr) {
+            Output(C_ERROR "Unable to map physical address %08x", args[0]);
+            return 0;
+        }
+        uint32 ret = 0;
+        if (setval)
+            memFill(vaddr, 1, val, wordsize);
+        else
+            ret = memRead(vaddr, wordsize);
+        memPhysUnmap(&pm);
+        return ret;
+    }
+    uint8 *vaddr = (uint8*)args[0];
     if (setval) {
         memFill(vaddr, 1, val, wordsize);
         return 0;
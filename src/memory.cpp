@@ -9,13 +9,15 @@
 #include "pkfuncs.h" // VirtualCopy
 
 #include "xtypes.h"
-#include "cpu.h" // cpuGetMMU
+#include "cpu.h" // DEF_GETCPR, MVAddr, take_control
 #include "memory.h"
+#include "physbackend.h" // PhysBackend
 #include "output.h" // Output
 #include "script.h" // REG_VAR_INT
 #include "exceptions.h" // TRY_EXCEPTION_HANDLER
 #include "lateload.h" // LATE_LOAD
 #include "machines.h" // Mach
+#include "cbitmap.h" // SETBIT
 
 
 /****************************************************************
@@ -64,6 +66,64 @@ mem_autodetect()
 }
 
 
+/****************************************************************
+ * Physical mapping statistics
+ ****************************************************************/
+
+// Number of latency histogram buckets (bucket N counts calls that
+// took 2^N to 2^(N+1) microseconds - the last bucket is open ended)
+#define PHYS_LAT_BUCKETS 16
+
+static struct physMapStats {
+    uint32 sectionHits, sectionMisses;
+    uint32 l2Hits, l2Misses, l2Stale;
+    uint32 wmHits, wmMisses, wmEvictions, wmFailures;
+    uint32 v2pHits, v2pMisses, v2pFlushes;
+    uint32 copyLatency[PHYS_LAT_BUCKETS];
+    uint32 freeLatency[PHYS_LAT_BUCKETS];
+} PhysMapStats;
+
+// Bump a counter - the mapper is used by several threads at once and
+// most lookups don't take PhysLock.  (Counters only ever updated with
+// PhysLock held are incremented directly.)
+#define PHYSSTAT_INC(Field) InterlockedIncrement((LONG*)&PhysMapStats.Field)
+
+// Performance counter frequency (0 if no high resolution counter)
+static uint64 PerfFreq;
+
+static void
+physStatsInit()
+{
+    LARGE_INTEGER f;
+    if (QueryPerformanceFrequency(&f))
+        PerfFreq = f.QuadPart;
+}
+
+static inline uint64
+perfNow()
+{
+    LARGE_INTEGER t;
+    if (!PerfFreq || !QueryPerformanceCounter(&t))
+        return 0;
+    return t.QuadPart;
+}
+
+// Account the time elapsed since 'start' in a latency histogram.
+static void
+physLatency(uint32 *hist, uint64 start)
+{
+    if (!PerfFreq)
+        return;
+    uint64 us = (perfNow() - start) * 1000000 / PerfFreq;
+    int b = 0;
+    while (us > 1 && b < PHYS_LAT_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    hist[b]++;
+}
+
+
 /****************************************************************
  * Mapping physical memory
  ****************************************************************/
@@ -77,92 +137,497 @@ mem_autodetect()
  * The second implementation, however, locks up on program exit
  * (haven't figured out why) so you have to choose between the two
  * implementations depending on your needs :-)
+ *
+ * The windows created with VirtualCopy are kept in a set-associative
+ * cache.  The set is selected by a hash of the window's physical
+ * base, and a clock sweep picks the window to replace within a set.
+ * Because of the VirtualFree() problem above, a window is only ever
+ * released when its set is full.
  */
 
-// The amount of physical memory locations to cache
-#define PHYS_CACHE_COUNT 8
-// Cache several last mapped physical memory for better effectivity
-static uint8 *phys_mem [PHYS_CACHE_COUNT];
-// The physical address (multiple of 32K, if 1 then slot is free)
-static uint32 phys_base [PHYS_CACHE_COUNT] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+// Number of windows in each cache set
+#define PHYS_CACHE_WAYS 4
+// Marker for a free window slot (never a valid window base)
+#define PHYS_NOWIN 1
+
+// Number of windows to cache (rounded down to a power of 2)
+static uint32 PhysCacheCount = 32;
+// Size of each window (power of 2, at least PHYS_CACHE_SIZE)
+static uint32 PhysCacheWin = PHYS_CACHE_SIZE;
+// A new geometry is only applied once no window is pinned - each
+// thread keeps PHYS_THREAD_WINS windows pinned until its next
+// memPhysMap call (or memPhysThreadDone), so while a background thread
+// is idle but alive the old cache stays in use.
+REG_VAR_INT(0, "PHYSCACHECOUNT", PhysCacheCount
+            , "Number of VirtualCopy windows cached by the physical mapper"
+              " (applied once background threads release their windows)")
+REG_VAR_INT(0, "PHYSCACHEWIN", PhysCacheWin
+            , "Size of each VirtualCopy physical mapper window"
+              " (power of 2, minimum 64K; applied once background threads"
+              " release their windows)")
+
+// Physical addresses to map whenever the cache is (re)built
+static uint32 PhysPremapCount;
+static uint32 PhysPremap[16];
+REG_VAR_INTLIST(0, "PHYSPREMAP", &PhysPremapCount, PhysPremap,
+                "Physical addresses (eg, peripheral bases) to map as soon"
+                " as the physical mapper cache is built")
+
+struct physWindow {
+    // The physical address (multiple of half a window, PHYS_NOWIN if free)
+    uint32 base;
+    // Virtual address of the window
+    uint8 *virt;
+    // Set on every hit - cleared by the clock sweep
+    uint32 used;
+    // Number of memPhysMapRange handles pinning the window
+    uint32 refs;
+    // Size of a dedicated window (0 for windows in the cache)
+    uint32 size;
+    // Dedicated windows only: cacheable mapping and list link
+    int cached;
+    struct physWindow *next;
+};
 
-/* We allocate windows in virtual address space for physical memory
- * in 64K chunks, however we always ensure there are at least 32K ahead
- * the address user requested.
- */
-uint8 *memPhysMap_wm(uint32 paddr)
+struct physSet {
+    struct physWindow way[PHYS_CACHE_WAYS];
+    // Next way to inspect during a clock sweep
+    uint32 hand;
+};
+
+// The active cache (built from PhysCacheCount/PhysCacheWin on demand)
+static struct physSet *PhysSets;
+static uint32 PhysSetBits, PhysWinSize, PhysWinShift;
+// The variable values the active cache was built from
+static uint32 PhysSetsCount, PhysSetsWin;
+// Number of handles pinning windows of the active cache
+static uint32 PhysPinned;
+// Windows mapped for handles that don't fit in a cache window
+static struct physWindow *PhysBigWins;
+
+// Number of windows each thread keeps pinned for memPhysMap
+#define PHYS_THREAD_WINS 4
+
+// The memPhysMap windows of one thread.  They can't be evicted by
+// other threads, so a memPhysMap pointer stays valid until the same
+// thread maps PHYS_THREAD_WINS other windows.
+struct physThreadCache {
+    struct physWindow *win[PHYS_THREAD_WINS];
+    // Next slot to replace
+    uint32 next;
+};
+static DWORD PhysTls;
+
+// Protects the window cache and the dedicated windows
+static CRITICAL_SECTION PhysLock;
+
+static struct physWindow *physWinGet(uint32 base);
+static void physCacheFree();
+
+static uint32
+log2floor(uint32 v)
 {
-  // Address should be aligned
-  paddr &= ~3;
+    uint32 l = 0;
+    while (v >>= 1)
+        l++;
+    return l;
+}
 
-  uint32 base = paddr & ~(PHYS_CACHE_MASK >> 1);
-  uint32 offs = paddr & (PHYS_CACHE_MASK >> 1);
+// Find the home set of the window starting at 'base'.
+static inline uint32
+physSetOf(uint32 base)
+{
+    if (!PhysSetBits)
+        return 0;
+    // Fibonacci hash of the window number so that regularly spaced
+    // peripheral banks don't all end up in the same set.
+    uint32 winnr = base >> PhysWinShift;
+    return (winnr * 0x9E3779B1) >> (32 - PhysSetBits);
+}
 
-  int slot = -1;
-  for (int i = 0; i < PHYS_CACHE_COUNT; i++)
-    if ((phys_base [i] == 1)
-     || (phys_base [i] == base))
-    {
-      slot = i;
-      break;
+// Look for the window starting at 'base' in set 'idx'.
+static struct physWindow *
+physSetFind(uint32 idx, uint32 base)
+{
+    struct physSet *set = &PhysSets[idx];
+    for (int i = 0; i < PHYS_CACHE_WAYS; i++)
+        if (set->way[i].base == base)
+            return &set->way[i];
+    return NULL;
+}
+
+// Build the window cache (if the configuration changed).  The caller
+// must hold PhysLock.
+static int
+physCacheSetup()
+{
+    if (PhysSets && PhysSetsCount == PhysCacheCount
+            && PhysSetsWin == PhysCacheWin)
+        return 0;
+    if (PhysSets && PhysPinned)
+        // Windows are in use - the new geometry is applied once
+        // they are all released.
+        return 0;
+
+    physCacheFree();
+
+    if (PhysCacheWin < PHYS_CACHE_SIZE || (PhysCacheWin & (PhysCacheWin-1))) {
+        Output(C_WARN "Invalid PHYSCACHEWIN %08x - using %08x"
+               , PhysCacheWin, PHYS_CACHE_SIZE);
+        PhysCacheWin = PHYS_CACHE_SIZE;
     }
+    uint32 sets = PhysCacheCount / PHYS_CACHE_WAYS;
+    if (!sets)
+        sets = 1;
+
+    PhysSetBits = log2floor(sets);
+    PhysWinSize = PhysCacheWin;
+    PhysWinShift = log2floor(PhysWinSize) - 1;
+    PhysSets = (struct physSet *)calloc(1 << PhysSetBits, sizeof(*PhysSets));
+    if (!PhysSets) {
+        Output(C_ERROR "Unable to allocate physical map cache");
+        return -1;
+    }
+    for (uint32 i = 0; i < (1U << PhysSetBits); i++)
+        for (int j = 0; j < PHYS_CACHE_WAYS; j++)
+            PhysSets[i].way[j].base = PHYS_NOWIN;
+    PhysSetsCount = PhysCacheCount;
+    PhysSetsWin = PhysCacheWin;
+
+    // Warm up the cache.
+    for (uint32 i = 0; i < PhysPremapCount; i++)
+        if (!physWinGet(PhysPremap[i] & ~((PhysWinSize >> 1) - 1)))
+            Output(C_WARN "Unable to premap physical address %08x"
+                   , PhysPremap[i]);
+    return 0;
+}
 
-  // If there is no empty slot, make it
-  if (slot == -1)
-  {
-    slot = PHYS_CACHE_COUNT - 1;
-    // This can lock up -- dunno why :-(
-    VirtualFree (phys_mem [slot], 0, MEM_RELEASE);
-    phys_base [slot] = 1;
-  }
+// Choose the window to (re)use within a set.  Returns NULL if all
+// the windows of the set are pinned.
+static struct physWindow *
+physSetVictim(struct physSet *set)
+{
+    for (int i = 0; i < PHYS_CACHE_WAYS; i++)
+        if (set->way[i].base == PHYS_NOWIN)
+            return &set->way[i];
+    for (int i = 0; i < 2 * PHYS_CACHE_WAYS; i++) {
+        struct physWindow *w = &set->way[set->hand];
+        set->hand = (set->hand + 1) % PHYS_CACHE_WAYS;
+        if (w->refs)
+            continue;
+        if (!w->used)
+            return w;
+        w->used = 0;
+    }
+    return NULL;
+}
 
-  // Move the cache element hit to the front (LRU)
-  if (slot)
-  {
-    uint32 tmp1 = phys_base [slot];
-    memmove (phys_base + 1, phys_base, slot * sizeof (uint32));
-    phys_base [0] = tmp1;
+// Map 'size' bytes of physical memory at 'base' into a new area of
+// virtual address space.
+static uint8 *
+physWinCreate(uint32 base, uint32 size, int cached)
+{
+    uint64 start = perfNow();
+    uint8 *virt = PhysBackend->mapPhys(base, size, cached);
+    physLatency(PhysMapStats.copyLatency, start);
+    if (!virt)
+        PHYSSTAT_INC(wmFailures);
+    return virt;
+}
 
-    uint8 *tmp2 = phys_mem [slot];
-    memmove (phys_mem + 1, phys_mem, slot * sizeof (uint8 *));
-    phys_mem [0] = tmp2;
-  }
+static void
+physWinRelease(uint8 *virt, uint32 size)
+{
+    memVirtToPhysFlush();
+    uint64 start = perfNow();
+    PhysBackend->unmapPhys(virt, size);
+    physLatency(PhysMapStats.freeLatency, start);
+}
 
-  // If slot has not been allocated yet, allocate it
-  if (phys_base [0] == 1)
-  {
-    phys_base [0] = base;
-    phys_mem [0] = (uint8 *)VirtualAlloc (NULL, PHYS_CACHE_SIZE,
-                                          MEM_RESERVE, PAGE_NOACCESS);
-    // Map requested physical memory to our virtual address hole
-    if (!VirtualCopy ((void *)phys_mem [0], (void *)(base / 256),
-                      PHYS_CACHE_SIZE, PAGE_READWRITE | PAGE_PHYSICAL | PAGE_NOCACHE))
-    {
-      VirtualFree (phys_mem [0], 0, MEM_RELEASE);
-      phys_mem [0] = NULL;
+// Find (or create) the cache window starting at physical 'base'.  A
+// window lives in its home set, or in the following set when all the
+// windows of the home set were pinned at the time it was created.
+static struct physWindow *
+physWinGet(uint32 base)
+{
+    uint32 idx = physSetOf(base);
+    uint32 next = (idx + 1) & ((1 << PhysSetBits) - 1);
+    struct physWindow *w = physSetFind(idx, base);
+    if (!w && next != idx)
+        w = physSetFind(next, base);
+    if (w) {
+        PHYSSTAT_INC(wmHits);
+        w->used = 1;
+        return w;
     }
-  }
 
-  // In the case of failure ...
-  if (!phys_mem [0])
-  {
-    phys_base [0] = 1;
-    return NULL;
-  }
+    // Miss - find a slot for the new window
+    PHYSSTAT_INC(wmMisses);
+    w = physSetVictim(&PhysSets[idx]);
+    if (!w && next != idx)
+        w = physSetVictim(&PhysSets[next]);
+    if (!w) {
+        PHYSSTAT_INC(wmFailures);
+        return NULL;
+    }
+    if (w->base != PHYS_NOWIN) {
+        PHYSSTAT_INC(wmEvictions);
+        physWinRelease(w->virt, PhysWinSize);
+        w->base = PHYS_NOWIN;
+        w->virt = NULL;
+    }
 
-  return phys_mem [0] + offs;
+    uint8 *virt = physWinCreate(base, PhysWinSize, 0);
+    if (!virt)
+        return NULL;
+    w->base = base;
+    w->virt = virt;
+    w->used = 1;
+    return w;
 }
 
-// Free the virtual memory pointers cache used by memPhysMap
-void memPhysReset ()
+// Pin a window covering 'size' bytes at 'paddr'.  Small uncached
+// requests share the cache windows - anything else gets a dedicated
+// (refcounted) window.  The caller must hold PhysLock.
+static struct physWindow *
+physWinPin(uint32 paddr, uint32 size, int cached)
 {
-  for (int i = 0; i < PHYS_CACHE_COUNT; i++)
-    if (phys_mem [i])
-    {
-      VirtualFree (phys_mem [i], 0, MEM_RELEASE);
-      phys_mem [i] = NULL;
-      phys_base [i] = 1;
+    uint32 base = paddr & ~((PhysWinSize >> 1) - 1);
+    struct physWindow *w;
+    if (!cached && paddr - base + size <= PhysWinSize) {
+        w = physWinGet(base);
+        if (w) {
+            w->refs++;
+            PhysPinned++;
+            return w;
+        }
+    }
+
+    for (w = PhysBigWins; w; w = w->next)
+        if (w->cached == cached && paddr >= w->base
+                && paddr - w->base + size <= w->size) {
+            PHYSSTAT_INC(wmHits);
+            w->refs++;
+            return w;
+        }
+
+    PHYSSTAT_INC(wmMisses);
+    base = paddr & ~(PAGE_SIZE - 1);
+    uint32 end = PAGE_ALIGN(paddr + size);
+    if (end <= base)
+        return NULL;
+    w = (struct physWindow *)calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->virt = physWinCreate(base, end - base, cached);
+    if (!w->virt) {
+        free(w);
+        return NULL;
+    }
+    w->base = base;
+    w->size = end - base;
+    w->cached = cached;
+    w->refs = 1;
+    w->next = PhysBigWins;
+    PhysBigWins = w;
+    return w;
+}
+
+// Drop a reference taken by physWinPin.  The caller must hold PhysLock.
+static void
+physWinUnpin(struct physWindow *w)
+{
+    if (!w->size) {
+        // Cache window - it is now a normal candidate for eviction.
+        w->refs--;
+        PhysPinned--;
+        return;
+    }
+    if (--w->refs)
+        return;
+    struct physWindow **pw = &PhysBigWins;
+    while (*pw != w)
+        pw = &(*pw)->next;
+    *pw = w->next;
+    physWinRelease(w->virt, w->size);
+    free(w);
+}
+
+// Find this thread's memPhysMap window cache.
+static struct physThreadCache *
+physThreadCache()
+{
+    struct physThreadCache *tc = (struct physThreadCache *)TlsGetValue(PhysTls);
+    if (!tc) {
+        tc = (struct physThreadCache *)calloc(1, sizeof(*tc));
+        TlsSetValue(PhysTls, tc);
+    }
+    return tc;
+}
+
+// Unpin all the windows of a thread cache.  The caller must hold
+// PhysLock.
+static void
+physThreadRelease(struct physThreadCache *tc)
+{
+    for (int i = 0; i < PHYS_THREAD_WINS; i++)
+        if (tc->win[i]) {
+            physWinUnpin(tc->win[i]);
+            tc->win[i] = NULL;
+        }
+}
+
+// Release the windows held for the current thread - threads that may
+// have called memPhysMap must call this before they exit.
+void
+memPhysThreadDone()
+{
+    struct physThreadCache *tc = (struct physThreadCache *)TlsGetValue(PhysTls);
+    if (!tc)
+        return;
+    EnterCriticalSection(&PhysLock);
+    physThreadRelease(tc);
+    LeaveCriticalSection(&PhysLock);
+    TlsSetValue(PhysTls, NULL);
+    free(tc);
+}
+
+/* We allocate windows in virtual address space for physical memory
+ * in PHYSCACHEWIN chunks, however we always ensure there are at least
+ * half a window (32K by default) ahead the address user requested.
+ * The window stays pinned in the calling thread's cache, so other
+ * threads can't evict it while this thread is still using it.
+ */
+uint8 *memPhysMap_wm(uint32 paddr)
+{
+    struct physThreadCache *tc = physThreadCache();
+    if (!tc)
+        return NULL;
+
+    // Address should be aligned
+    paddr &= ~3;
+
+    // Look in the windows this thread holds - no other thread can
+    // release them, so no locking is needed.
+    uint32 half = PhysWinSize >> 1;
+    if (PhysSets && PhysSetsCount == PhysCacheCount
+            && PhysSetsWin == PhysCacheWin)
+        for (int i = 0; i < PHYS_THREAD_WINS; i++) {
+            struct physWindow *w = tc->win[i];
+            uint32 size = w && w->size ? w->size : PhysWinSize;
+            if (w && paddr >= w->base && paddr - w->base <= size - half) {
+                PHYSSTAT_INC(wmHits);
+                return w->virt + (paddr - w->base);
+            }
+        }
+
+    EnterCriticalSection(&PhysLock);
+    uint8 *ret = NULL;
+    if (PhysSets && (PhysSetsCount != PhysCacheCount
+                     || PhysSetsWin != PhysCacheWin))
+        // Let the cache be rebuilt with the new configuration.
+        physThreadRelease(tc);
+    if (!physCacheSetup()) {
+        uint32 base = paddr & ~((PhysWinSize >> 1) - 1);
+        struct physWindow *w = physWinPin(base, PhysWinSize, 0);
+        if (w) {
+            uint32 slot = tc->next;
+            tc->next = (slot + 1) % PHYS_THREAD_WINS;
+            if (tc->win[slot])
+                physWinUnpin(tc->win[slot]);
+            tc->win[slot] = w;
+            ret = w->virt + (paddr - w->base);
+        }
     }
+    LeaveCriticalSection(&PhysLock);
+    return ret;
+}
+
+// Pin a VirtualCopy window covering 'size' bytes at 'paddr' for a
+// memPhysMapRange handle.
+static uint8 *
+memPhysMap_pin(struct physMapping *pm, uint32 paddr, uint32 size, int cached)
+{
+    uint8 *ret = NULL;
+    EnterCriticalSection(&PhysLock);
+    if (!physCacheSetup()) {
+        struct physWindow *w = physWinPin(paddr, size, cached);
+        if (w) {
+            pm->win = w;
+            ret = w->virt + (paddr - w->base);
+        }
+    }
+    LeaveCriticalSection(&PhysLock);
+    return ret;
+}
+
+// Release a handle obtained from memPhysMapRange.
+void
+memPhysUnmap(struct physMapping *pm)
+{
+    struct physWindow *w = pm->win;
+    pm->vaddr = NULL;
+    pm->win = NULL;
+    if (!w)
+        return;
+    EnterCriticalSection(&PhysLock);
+    physWinUnpin(w);
+    LeaveCriticalSection(&PhysLock);
+}
+
+// Release the windows of the cache that aren't pinned, and the cache
+// itself once no window is.  The caller must hold PhysLock.
+static void
+physCacheFree()
+{
+    if (!PhysSets)
+        return;
+    for (uint32 i = 0; i < (1U << PhysSetBits); i++)
+        for (int j = 0; j < PHYS_CACHE_WAYS; j++) {
+            struct physWindow *w = &PhysSets[i].way[j];
+            if (w->base != PHYS_NOWIN && !w->refs) {
+                PhysBackend->unmapPhys(w->virt, PhysWinSize);
+                w->base = PHYS_NOWIN;
+                w->virt = NULL;
+            }
+        }
+    if (PhysPinned)
+        return;
+    free (PhysSets);
+    PhysSets = NULL;
+}
+
+// Check whether 'mva' (a modified virtual address) lies in one of our
+// own VirtualCopy windows.  The caller must hold PhysLock.
+static bool
+physWinOwns(uint32 mva)
+{
+    for (uint32 i = 0; PhysSets && i < (1U << PhysSetBits); i++)
+        for (int j = 0; j < PHYS_CACHE_WAYS; j++) {
+            struct physWindow *w = &PhysSets[i].way[j];
+            if (w->base != PHYS_NOWIN
+                    && IN_RANGE(mva, PhysBackend->mvaddr((uint32)w->virt)
+                                , PhysWinSize))
+                return true;
+        }
+    for (struct physWindow *w = PhysBigWins; w; w = w->next)
+        if (IN_RANGE(mva, PhysBackend->mvaddr((uint32)w->virt), w->size))
+            return true;
+    return false;
+}
+
+// Free the virtual memory pointers cache used by memPhysMap.  Only
+// the calling thread's memPhysMap windows are released - windows other
+// threads (or memPhysMapRange handles) still hold stay mapped.
+void memPhysReset ()
+{
+    EnterCriticalSection(&PhysLock);
+    struct physThreadCache *tc = (struct physThreadCache *)TlsGetValue(PhysTls);
+    if (tc)
+        physThreadRelease(tc);
+    physCacheFree();
+    LeaveCriticalSection(&PhysLock);
+    memVirtToPhysFlush();
 }
 
 #else
@@ -376,24 +841,18 @@ static uint32 *MMUTable;
 static void
 mapInMMU()
 {
-    int ret;
-    void *area;
-    void *mmu;
+    uint8 *area;
+    uint32 mmu;
     TRY_EXCEPTION_HANDLER {
-        mmu = (void*)(cpuGetMMU() >> 8);
+        mmu = PhysBackend->mmuBase();
     } CATCH_EXCEPTION_HANDLER {
         Output("Exception on mmu table lookup");
         goto fail;
     }
 
-    area = VirtualAlloc(NULL, 4096*4, MEM_RESERVE, PAGE_NOACCESS);
-    if (! area)
-        goto fail;
-
     // Map mmu physical location into address space.
-    ret = VirtualCopy(area, mmu, 4096*4
-                      , PAGE_READWRITE | PAGE_PHYSICAL | PAGE_NOCACHE);
-    if (!ret)
+    area = PhysBackend->mapPhys(mmu, 4096*4, 0);
+    if (! area)
         goto fail;
 
     MMUTable = (uint32*)area;
@@ -408,12 +867,122 @@ fail:
 // Get cp15/c1 register
 DEF_GETCPR(get_p15r1, p15, 0, c1, c0, 0)
 
-static int Arm6NoSubPages;
+int Arm6NoSubPages;
 static int16 PhysMapCached[4096];
 static int16 PhysMapUncached[4096];
 
+// A run of physically and virtually continuous L2 page mappings.
+struct physExtent {
+    uint32 paddr, vaddr, size;
+};
+
+// List of L2 extents sorted by physical address.
+struct physExtentList {
+    struct physExtent *list;
+    uint32 count, max;
+    // Size of the largest extent (bounds the backwards search)
+    uint32 maxsize;
+};
+
+static struct physExtentList PhysExtCached, PhysExtUncached;
+// Set once the extent lists are sorted and may be searched
+static int PhysExtValid;
+
+// Only L2 tables mapping addresses above this are indexed - lower
+// addresses belong to process slots which wince remaps at will.
+#define PHYS_REVMAP_L2START 0x80000000
+
+// Add a page mapping to an extent list (merging it with the previous
+// extent where possible).
+static void
+addExtent(struct physExtentList *el, uint32 paddr, uint32 vaddr, uint32 size)
+{
+    struct physExtent *e;
+    if (el->count) {
+        e = &el->list[el->count - 1];
+        if (e->vaddr + e->size == vaddr && e->paddr + e->size == paddr) {
+            e->size += size;
+            if (e->size > el->maxsize)
+                el->maxsize = e->size;
+            return;
+        }
+    }
+    if (el->count >= el->max) {
+        uint32 max = el->max ? el->max * 2 : 64;
+        e = (struct physExtent *)realloc(el->list, max * sizeof(*e));
+        if (!e)
+            return;
+        el->list = e;
+        el->max = max;
+    }
+    e = &el->list[el->count++];
+    e->paddr = paddr;
+    e->vaddr = vaddr;
+    e->size = size;
+    if (size > el->maxsize)
+        el->maxsize = size;
+}
+
+// Sort compare function (compare by physical address, larger first).
+static int physExtentComp(const void *e1, const void *e2) {
+    physExtent *i1 = (physExtent*)e1, *i2 = (physExtent*)e2;
+    if (i1->paddr != i2->paddr)
+        return i1->paddr < i2->paddr ? -1 : 1;
+    return (i1->size > i2->size ? -1 : (i1->size < i2->size ? 1 : 0));
+}
+
+// Sort an extent list and drop extents covered by another extent.
+static void
+sortExtents(struct physExtentList *el)
+{
+    if (!el->count)
+        return;
+    qsort(el->list, el->count, sizeof(el->list[0]), physExtentComp);
+    uint32 j = 0;
+    for (uint32 i = 1; i < el->count; i++) {
+        struct physExtent *p = &el->list[j], *e = &el->list[i];
+        if (e->paddr + e->size <= p->paddr + p->size)
+            continue;
+        el->list[++j] = *e;
+    }
+    el->count = j + 1;
+}
+
+// Index the small and large pages of a coarse L2 table.
+static int
+findReverseL2maps(uint32 mb, uint32 l1d)
+{
+    uint32 *l2 = (uint32*)memPhysMap(l1d & MMU_L1_COARSE_MASK);
+    if (!l2)
+        return 0;
+    int count = 0;
+    for (uint32 d = 0; d < 256; d++) {
+        uint32 l2d = l2[d];
+        const struct pageinfo *pi = getL2Desc(l2d);
+        if (!pi->isMapped || pi->mask == MMU_L2_TINY_MASK)
+            continue;
+        // Large pages are repeated 16 times in a coarse table - so
+        // just add each 4K slice.
+        uint32 vaddr = (mb << 20) | (d << 12);
+        // Our own windows come and go - never hand them out.
+        if (physWinOwns(vaddr))
+            continue;
+        uint32 paddr = (l2d & pi->mask) | (vaddr & ~pi->mask);
+        uint32 cacheval = l2d & (MMU_L2_CACHEABLE|MMU_L2_BUFFERABLE);
+        if (!cacheval)
+            addExtent(&PhysExtUncached, paddr, vaddr, PAGE_SIZE);
+        else if (cacheval == (MMU_L2_CACHEABLE|MMU_L2_BUFFERABLE))
+            addExtent(&PhysExtCached, paddr, vaddr, PAGE_SIZE);
+        else
+            continue;
+        count++;
+    }
+    return count;
+}
+
 // Search a given mmu table for an l1 section mapping that provides a
 // virtual to physical mapping for a specified physical base location.
+// Kernel L2 page mappings are indexed into the PhysExt lists.
 static void
 findReverseMMUmaps()
 {
@@ -431,18 +1000,32 @@ findReverseMMUmaps()
     // Clear maps.
     memset(PhysMapCached, -1, sizeof(PhysMapCached));
     memset(PhysMapUncached, -1, sizeof(PhysMapUncached));
+    PhysExtValid = 0;
+    PhysExtCached.count = PhysExtCached.maxsize = 0;
+    PhysExtUncached.count = PhysExtUncached.maxsize = 0;
 
     // Populate maps.
-    int uncache_count = 0, cache_count = 0, ignore_count = 0;
+    EnterCriticalSection(&PhysLock);
+    int uncache_count = 0, cache_count = 0, ignore_count = 0, l2_count = 0;
     for (uint32 i=0; i<4096; i++) {
         uint32 l1d = MMUTable[i];
+        if ((l1d & MMU_L1_TYPE_MASK) == MMU_L1_COARSE_L2
+            && i >= (PHYS_REVMAP_L2START >> 20)) {
+            TRY_EXCEPTION_HANDLER {
+                l2_count += findReverseL2maps(i, l1d);
+            } CATCH_EXCEPTION_HANDLER {
+                Output("Exception reading L2 table for %08x", i << 20);
+            }
+            continue;
+        }
         if ((l1d & MMU_L1_TYPE_MASK) != MMU_L1_SECTION)
             // Only interested in section mappings.
             continue;
-        if (Mach->arm6mmu && (l1d & MMU_L1_SUPER_SECTION_FLAG))
-            // No support for "supersection" mappings.
-            continue;
         uint16 base = l1d >> 20;
+        if (Mach->arm6mmu && (l1d & MMU_L1_SUPER_SECTION_FLAG))
+            // A "supersection" is repeated in 16 consecutive entries
+            // - each entry provides one megabyte of the 16MB area.
+            base = ((l1d & MMU_L1_SUPER_SECTION_MASK) >> 20) | (i & 0xf);
         uint32 cacheval = l1d & (MMU_L1_CACHEABLE|MMU_L1_BUFFERABLE);
         if (!cacheval && PhysMapUncached[base] == -1) {
             // Found a new uncached mapping.
@@ -461,8 +1044,15 @@ findReverseMMUmaps()
         }
     }
 
+    sortExtents(&PhysExtCached);
+    sortExtents(&PhysExtUncached);
+    PhysExtValid = 1;
+    LeaveCriticalSection(&PhysLock);
+
     Output("Found %d uncached and %d cached L1 mappings (ignored %d)."
            , uncache_count, cache_count, ignore_count);
+    Output("Found %d L2 pages in %d uncached and %d cached extents."
+           , l2_count, PhysExtUncached.count, PhysExtCached.count);
 }
 
 // Try to obtain a virtual to physical map by reusing one of the wm
@@ -482,9 +1072,88 @@ memPhysMap_section(uint32 paddr, int cached=0)
     return (uint8*)((((uint32)m[base]) << 20) | (paddr & ((1<<20) - 1)));
 }
 
-static uint32 PhysicalMapMethod = 1;
+// Check that the kernel still maps the 'size' bytes at 'vaddr' to
+// 'paddr' with the wanted cache mode.  The kernel L2 tables belong to
+// VirtualAlloc/VirtualCopy areas that wince changes at runtime, so an
+// extent found by findReverseMMUmaps may since have been remapped.
+static bool
+physL2Current(uint32 vaddr, uint32 paddr, uint32 size, int cached)
+{
+    uint32 want = cached ? (MMU_L2_CACHEABLE|MMU_L2_BUFFERABLE) : 0;
+    uint32 offs = vaddr & (PAGE_SIZE - 1);
+    for (uint32 i = 0; i < offs + size; i += PAGE_SIZE) {
+        uint32 va = vaddr - offs + i, pa = paddr - offs + i;
+        uint32 l1d = MMUTable[va >> 20];
+        if ((l1d & MMU_L1_TYPE_MASK) != MMU_L1_COARSE_L2)
+            return false;
+        // The table is read through a section mapping only - going
+        // through memPhysMap could end up back here.
+        uint32 *l2 = (uint32*)memPhysMap_section(
+            (l1d & MMU_L1_COARSE_MASK) + ((va >> 12) & 0xff) * 4);
+        if (!l2)
+            return false;
+        uint32 l2d = *l2;
+        const struct pageinfo *pi = getL2Desc(l2d);
+        if (!pi->isMapped || pi->mask == MMU_L2_TINY_MASK
+            || ((l2d & pi->mask) | (va & ~pi->mask)) != pa
+            || (l2d & (MMU_L2_CACHEABLE|MMU_L2_BUFFERABLE)) != want)
+            return false;
+    }
+    return true;
+}
+
+// Try to obtain a virtual to physical map of at least 'size' bytes
+// by reusing one of the wm L2 page mappings.  Wince may remap the
+// pages at any time, so the map is only good for an access made right
+// away - see physMapRange.
+static uint8 *
+memPhysMap_l2(uint32 paddr, uint32 size, int cached=0)
+{
+    if (!PhysExtValid)
+        return NULL;
+    struct physExtentList *el = &PhysExtUncached;
+    if (cached)
+        el = &PhysExtCached;
+
+    uint8 *ret = NULL;
+    EnterCriticalSection(&PhysLock);
+
+    // Find the first extent starting after paddr.
+    uint32 lo = 0, hi = el->count;
+    while (lo < hi) {
+        uint32 mid = (lo + hi) / 2;
+        if (el->list[mid].paddr <= paddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // Check the extents starting at or before paddr.
+    while (lo--) {
+        struct physExtent *e = &el->list[lo];
+        if (paddr - e->paddr >= el->maxsize)
+            break;
+        if (!IN_RANGE(paddr, e->paddr, e->size)
+            || e->paddr + e->size - paddr < size)
+            continue;
+        // Only the pages about to be accessed are checked.
+        uint32 vaddr = e->vaddr + (paddr - e->paddr);
+        if (!physL2Current(vaddr, paddr, size, cached)) {
+            // Stale - forget the extent.
+            PHYSSTAT_INC(l2Stale);
+            e->size = 0;
+            break;
+        }
+        ret = (uint8*)vaddr;
+        break;
+    }
+    LeaveCriticalSection(&PhysLock);
+    return ret;
+}
+
+static uint32 PhysicalMapMethod = 5;
 REG_VAR_INT(0, "PHYSMAPMETHOD", PhysicalMapMethod
-            , "Physical map method (1=1meg cache, 0=VirtualCopy only)")
+            , "Physical map method (bitmask: 1=1meg cache, 4=kernel L2 page"
+              " cache for block copies, 0=VirtualCopy only)")
 
 // Map physical memory to a virtual address. The function ensures
 // that at least 32K memory ahead of given address is available
@@ -493,10 +1162,16 @@ memPhysMap(uint32 paddr)
 {
     if (PhysicalMapMethod & 1) {
         uint8 *ret = memPhysMap_section(paddr);
-        if (ret)
+        if (ret) {
+            PHYSSTAT_INC(sectionHits);
             return ret;
+        }
+        PHYSSTAT_INC(sectionMisses);
     }
 
+    // The kernel L2 page maps aren't used here - callers keep the
+    // pointer for a while and the kernel can remap those pages.
+
 #if 0
     if (PhysicalMapMethod & 2)
         return memPhysMap_bruteforce(paddr);
@@ -505,17 +1180,182 @@ memPhysMap(uint32 paddr)
     return memPhysMap_wm(paddr);
 }
 
+// Try to obtain a map of 'size' bytes from the 1-meg section mappings
+// (the sections must be virtually continuous).
+static uint8 *
+memPhysMap_sections(uint32 paddr, uint32 size, int cached)
+{
+    uint8 *ret = memPhysMap_section(paddr, cached);
+    if (!ret)
+        return NULL;
+    uint32 first = paddr >> 20, last = (paddr + size - 1) >> 20;
+    if (last < first)
+        return NULL;
+    int16 *m = cached ? PhysMapCached : PhysMapUncached;
+    for (uint32 mb = first + 1; mb <= last; mb++)
+        if (m[mb] != m[first] + (int)(mb - first))
+            return NULL;
+    return ret;
+}
+
+// Map 'size' bytes of physical memory at 'paddr' for a handle.  If
+// 'useL2' is set a kernel L2 page map may be returned - it can't be
+// pinned, so it must be accessed at once and not kept.
+static uint8 *
+physMapRange(struct physMapping *pm, uint32 paddr, uint32 size, int cached
+             , int useL2)
+{
+    pm->paddr = paddr;
+    pm->size = size;
+    pm->win = NULL;
+    pm->vaddr = NULL;
+    if (!size)
+        size = 1;
+
+    if (PhysicalMapMethod & 1) {
+        pm->vaddr = memPhysMap_sections(paddr, size, cached);
+        if (pm->vaddr) {
+            PHYSSTAT_INC(sectionHits);
+            return pm->vaddr;
+        }
+        PHYSSTAT_INC(sectionMisses);
+    }
+
+    if (useL2 && (PhysicalMapMethod & 4)) {
+        pm->vaddr = memPhysMap_l2(paddr, size, cached);
+        if (pm->vaddr) {
+            PHYSSTAT_INC(l2Hits);
+            return pm->vaddr;
+        }
+        PHYSSTAT_INC(l2Misses);
+    }
+
+    pm->vaddr = memPhysMap_pin(pm, paddr, size, cached);
+    return pm->vaddr;
+}
+
+// Map 'size' bytes of physical memory at 'paddr'.  Unlike memPhysMap
+// the mapping covers exactly the requested range and stays valid until
+// it is released with memPhysUnmap.
+uint8 *
+memPhysMapRange(struct physMapping *pm, uint32 paddr, uint32 size, int cached)
+{
+    return physMapRange(pm, paddr, size, cached, 0);
+}
+
+// Report the physical mapper statistics.
+static void
+dumpPhysMap(const char *tok, const char *args)
+{
+    uint32 reset = 0;
+    get_expression(&args, &reset);
+
+    struct physMapStats *st = &PhysMapStats;
+    Output("Physical map method %d, VirtualCopy cache %d x %08x"
+           , PhysicalMapMethod
+           , PhysSets ? (PHYS_CACHE_WAYS << PhysSetBits) : 0, PhysWinSize);
+    Output("Section map: hits=%u misses=%u"
+           , st->sectionHits, st->sectionMisses);
+    Output("L2 page map: hits=%u misses=%u stale=%u"
+           , st->l2Hits, st->l2Misses, st->l2Stale);
+    Output("VirtualCopy: hits=%u misses=%u evictions=%u failures=%u"
+           , st->wmHits, st->wmMisses, st->wmEvictions, st->wmFailures);
+    uint32 lookups = st->v2pHits + st->v2pMisses;
+    Output("V2P cache: hits=%u misses=%u flushes=%u (hit rate %u%%)"
+           , st->v2pHits, st->v2pMisses, st->v2pFlushes
+           , lookups ? (uint32)((uint64)st->v2pHits * 100 / lookups) : 0);
+    if (!PerfFreq) {
+        Output("No performance counter - latencies not available");
+    } else {
+        Output("   Latency (us) | VirtualCopy | VirtualFree");
+        for (int i = 0; i < PHYS_LAT_BUCKETS; i++) {
+            if (!st->copyLatency[i] && !st->freeLatency[i])
+                continue;
+            if (i == PHYS_LAT_BUCKETS - 1)
+                Output("  %6d+        | %11u | %11u"
+                       , 1 << i, st->copyLatency[i], st->freeLatency[i]);
+            else
+                Output("  %6d..%-6d | %11u | %11u"
+                       , i ? 1 << i : 0, (1 << (i+1)) - 1
+                       , st->copyLatency[i], st->freeLatency[i]);
+        }
+    }
+
+    if (reset) {
+        EnterCriticalSection(&PhysLock);
+        memset(st, 0, sizeof(*st));
+        LeaveCriticalSection(&PhysLock);
+    }
+}
+REG_DUMP(0, "PHYSMAP", dumpPhysMap,
+         "PHYSMAP [<reset>]\n"
+         "  Show physical mapper hit/miss counters and VirtualCopy/VirtualFree\n"
+         "  latencies.  The counters are cleared if <reset> is non-zero.")
+
+#define PHYSMAP_STATVAR(Name, Field, Desc)                              \
+static uint32 var_ ##Field(bool setval, uint32 *args, uint32 val) {     \
+    return PhysMapStats.Field;                                          \
+}                                                                       \
+REG_VAR_ROFUNC(0, Name, var_ ##Field, 0, Desc)
+
+PHYSMAP_STATVAR("PMSECTIONHITS", sectionHits
+                , "Physical maps satisfied by an existing 1MB section")
+PHYSMAP_STATVAR("PMSECTIONMISSES", sectionMisses
+                , "Physical maps not covered by an existing 1MB section")
+PHYSMAP_STATVAR("PML2HITS", l2Hits
+                , "Physical maps satisfied by an existing kernel L2 page map")
+PHYSMAP_STATVAR("PML2MISSES", l2Misses
+                , "Physical maps not covered by a kernel L2 page map")
+PHYSMAP_STATVAR("PML2STALE", l2Stale
+                , "Kernel L2 page maps dropped because wince had remapped them")
+PHYSMAP_STATVAR("PMWMHITS", wmHits
+                , "Physical maps satisfied by the VirtualCopy window cache")
+PHYSMAP_STATVAR("PMWMMISSES", wmMisses
+                , "Physical maps that required a new VirtualCopy window")
+PHYSMAP_STATVAR("PMWMEVICTIONS", wmEvictions
+                , "VirtualCopy windows released to make room for a new one")
+PHYSMAP_STATVAR("PMWMFAILURES", wmFailures
+                , "Physical maps where VirtualAlloc/VirtualCopy failed")
+PHYSMAP_STATVAR("V2PHITS", v2pHits
+                , "Virtual to physical translations found in the V2P cache")
+PHYSMAP_STATVAR("V2PMISSES", v2pMisses
+                , "Virtual to physical translations that walked the mmu tables")
+
+static uint32
+var_pmCopyLatency(bool setval, uint32 *args, uint32 val)
+{
+    if (args[0] >= PHYS_LAT_BUCKETS)
+        return 0;
+    return PhysMapStats.copyLatency[args[0]];
+}
+REG_VAR_ROFUNC(0, "PMCOPYLATENCY", var_pmCopyLatency, 1
+               , "Number of VirtualCopy calls that took 2^N us (N=0..15)")
+
+static uint32
+var_pmFreeLatency(bool setval, uint32 *args, uint32 val)
+{
+    if (args[0] >= PHYS_LAT_BUCKETS)
+        return 0;
+    return PhysMapStats.freeLatency[args[0]];
+}
+REG_VAR_ROFUNC(0, "PMFREELATENCY", var_pmFreeLatency, 1
+               , "Number of VirtualFree calls that took 2^N us (N=0..15)")
+
 // This function is called at startup - initialize memory handling routines.
 void
 setupMemory()
 {
+    InitializeCriticalSection(&PhysLock);
+    PhysTls = TlsAlloc();
+
     Output("Detecting ram size");
     mem_autodetect();
+    physStatsInit();
 
     Output("Mapping mmu table");
     mapInMMU();
 
-    Output("Build L1 reverse map");
+    Output("Build L1/L2 reverse map");
     findReverseMMUmaps();
 }
 
@@ -712,11 +1552,70 @@ getL2Desc(uint32 l2d)
     return &L2PageInfo[type];
 }
 
-// Translate a virtual address to physical
+// Number of cached virtual to physical translations (power of 2)
+#define V2P_CACHE_SIZE 64
+
+// A cached translation of one page
+struct v2pEntry {
+    // Odd while the entry is being written
+    volatile uint32 seq;
+    volatile uint32 mva, paddr;
+    // The V2PGen value the entry was filled in
+    volatile uint32 gen;
+};
+
+static struct v2pEntry V2PCache[V2P_CACHE_SIZE];
+// Incrementing this invalidates all the entries
+static volatile uint32 V2PGen = 1;
+// Only kernel addresses are cached - wince remaps the process slots
+// below this on its own.
+#define V2P_CACHE_START 0x80000000
+
+static uint32 V2PCacheEnable = 1;
+REG_VAR_INT(0, "V2PCACHE", V2PCacheEnable
+            , "Cache virtual to physical translations of kernel addresses"
+              " (0 to disable)")
+
+// Discard all cached virtual to physical translations.  This must be
+// called whenever the mmu tables are changed.
+void
+memVirtToPhysFlush()
+{
+    InterlockedIncrement((LONG*)&V2PGen);
+    PHYSSTAT_INC(v2pFlushes);
+}
+
+static void
+cmd_v2pflush(const char *cmd, const char *args)
+{
+    memVirtToPhysFlush();
+}
+REG_CMD(0, "V2PFLUSH", cmd_v2pflush,
+        "V2PFLUSH\n"
+        "  Discard the cached virtual to physical translations.")
+
+// Translate a virtual address to physical.  The V2P cache is read
+// without locks (this is called with interrupts off) - a reader
+// retries the walk if the entry changed while it was being read.
 uint32
 memVirtToPhys(uint32 vaddr)
 {
-    vaddr = MVAddr(vaddr);
+    vaddr = PhysBackend->mvaddr(vaddr);
+    uint32 page = vaddr & ~(PAGE_SIZE - 1);
+    struct v2pEntry *e = &V2PCache[(vaddr / PAGE_SIZE) & (V2P_CACHE_SIZE - 1)];
+    int cache = V2PCacheEnable && vaddr >= V2P_CACHE_START;
+    uint32 gen = V2PGen;
+    if (cache) {
+        uint32 seq = e->seq;
+        uint32 mva = e->mva, paddr = e->paddr, egen = e->gen;
+        if (!(seq & 1) && e->seq == seq && egen == gen && mva == page
+                && V2PGen == gen) {
+            PHYSSTAT_INC(v2pHits);
+            return paddr | (vaddr & (PAGE_SIZE - 1));
+        }
+        PHYSSTAT_INC(v2pMisses);
+    }
+
     uint32 desc = MMUTable[vaddr >> 20];
     const struct pageinfo *pi = getL1Desc(desc);
     if (pi->L2MapShift) {
@@ -726,7 +1625,23 @@ memVirtToPhys(uint32 vaddr)
     }
     if (! pi->isMapped)
         return (uint32)-1;
-    return (desc & pi->mask) | (vaddr & ~pi->mask);
+    uint32 paddr = (desc & pi->mask) | (vaddr & ~pi->mask);
+
+    // Tiny (1K) pages can't be cached with page granularity.  Skip the
+    // update if another thread is writing the entry.  If the cache was
+    // flushed during the walk the entry gets the old generation, so it
+    // is never used.
+    if (cache && ~pi->mask >= PAGE_SIZE - 1) {
+        uint32 seq = e->seq;
+        if (!(seq & 1) && (uint32)InterlockedCompareExchange(
+                (LONG*)&e->seq, seq + 1, seq) == seq) {
+            e->mva = page;
+            e->paddr = paddr & ~(PAGE_SIZE - 1);
+            e->gen = gen;
+            e->seq = seq + 2;
+        }
+    }
+    return paddr;
 }
 
 
@@ -738,10 +1653,8 @@ memVirtToPhys(uint32 vaddr)
 void
 freePages(void *data)
 {
-    int ret = UnmapViewOfFile(data);
-    if (!ret)
-        Output(C_ERROR "UnmapViewOfFile failed %p (code %ld)"
-               , data, GetLastError());
+    memVirtToPhysFlush();
+    PhysBackend->freePages(data);
 }
 
 // Allocate and pin 'pageCount' number of pages and fill 'pages'
@@ -749,43 +1662,7 @@ freePages(void *data)
 void *
 allocPages(struct pageAddrs *pages, int pageCount)
 {
-    int pageBytes = pageCount * PAGE_SIZE;
-    HANDLE h = CreateFileMapping(
-        (HANDLE)INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
-        0, pageBytes, NULL);
-    if (!h) {
-        Output(C_ERROR "Failed to allocate %d pages (code %ld)"
-               , pageCount, GetLastError());
-        return NULL;
-    }
-
-    void *data = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, 0);
-    int ret = CloseHandle(h);
-    if (!data) {
-        Output(C_ERROR "Failed to map %d pages (code %ld)"
-               , pageCount, GetLastError());
-        return NULL;
-    }
-    if (!ret)
-        Output(C_WARN "CloseHandle failed (code %ld)", GetLastError());
-
-    DWORD pfns[pageCount];
-    ret = LockPages(data, pageBytes, pfns, LOCKFLAG_WRITE);
-    if (!ret) {
-        Output(C_ERROR "Failed to lock %d pages (code %ld)"
-               , pageCount, GetLastError());
-        freePages(data);
-        return NULL;
-    }
-
-    // Find all the physical locations of the pages.
-    for (int i = 0; i < pageCount; i++) {
-        struct pageAddrs *pd = &pages[i];
-        pd->virtLoc = &((char *)data)[PAGE_SIZE * i];
-        pd->physLoc = pfns[i]; // XXX should: x << UserKInfo[KINX_PFN_SHIFT]
-    }
-
-    return data;
+    return PhysBackend->allocPages(pages, pageCount);
 }
 
 
@@ -793,79 +1670,164 @@ allocPages(struct pageAddrs *pages, int pageCount)
  * Continuous page allocation
  ****************************************************************/
 
-// Sort compare function (compare by physical address).
-static int physPageComp(const void *e1, const void *e2) {
-    pageAddrs *i1 = (pageAddrs*)e1, *i2 = (pageAddrs*)e2;
-    return (i1->physLoc < i2->physLoc ? -1
-            : (i1->physLoc > i2->physLoc ? 1 : 0));
-}
-
 struct continuousPageInfo {
+    uint32 count;
+    // The allocPages() areas holding the continuous pages
+    void *rawdata[0];
+};
+#define size_continuousPageInfo(nrdata) \
+    ((uint32)(&((continuousPageInfo*)0)->rawdata[nrdata]))
+
+// A set of pages allocated while looking for continuous pages.
+struct pageBatch {
     void *rawdata;
-    struct pageAddrs pages[0];
+    uint32 count;
+    struct pageAddrs *pages;
 };
-#define size_continuousPageInfo(nrpages) \
-    ((uint32)(&((continuousPageInfo*)0)->pages[nrpages]))
+
+// Maximum number of batches to allocate - each one doubles the number
+// of candidate pages.
+#define ACP_MAX_BATCHES 16
 
 static void
 fcp_emulate(struct continuousPageInfo *info)
 {
     if (! info)
         return;
-    if (info->rawdata)
-        freePages(info->rawdata);
+    for (uint32 i = 0; i < info->count; i++)
+        freePages(info->rawdata[i]);
     free(info);
 }
 
+// Find a run of 'count' set bits in a bitmap of 'bits' bits.  Returns
+// the position of the first bit of the run, or -1 if there is none.
+static int
+findBitRun(uint32 *bitmap, uint32 bits, uint32 count)
+{
+    uint32 run = 0;
+    for (uint32 i = 0; i < bits; i++) {
+        if (!(i & (LONGBITS-1))) {
+            // Skip over empty and full words at once.
+            uint32 w = BITMAPPOS(bitmap, i);
+            if (!w) {
+                run = 0;
+                i += LONGBITS - 1;
+                continue;
+            }
+            if (w == ~0U && run + LONGBITS < count) {
+                run += LONGBITS;
+                i += LONGBITS - 1;
+                continue;
+            }
+        }
+        if (!TESTBIT(bitmap, i)) {
+            run = 0;
+            continue;
+        }
+        if (++run >= count)
+            return i - (count - 1);
+    }
+    return -1;
+}
+
 static void *
 acp_emulate(uint32 pageCount, struct continuousPageInfo **info)
 {
-    struct continuousPageInfo *ci = NULL;
-    uint32 trycount = pageCount;
+    struct pageBatch batches[ACP_MAX_BATCHES];
+    uint32 nbatch = 0, total = 0;
+    uint32 *bitmap = NULL;
+    void *data = NULL;
+    *info = NULL;
     if (pageCount < 2)
         // Huh?
         goto fail;
 
-    for (;;) {
-        ci = (struct continuousPageInfo *)malloc(
-            size_continuousPageInfo(trycount));
+    while (nbatch < ACP_MAX_BATCHES) {
+        // Allocate more candidate pages (doubling the number held)
+        // while keeping the ones from earlier attempts.
+        uint32 trycount = total ? total : pageCount;
+        struct pageBatch *b = &batches[nbatch];
+        b->pages = (struct pageAddrs *)malloc(trycount * sizeof(b->pages[0]));
+        if (! b->pages)
+            break;
+        b->rawdata = allocPages(b->pages, trycount);
+        if (! b->rawdata) {
+            free(b->pages);
+            break;
+        }
+        b->count = trycount;
+        nbatch++;
+        total += trycount;
+
+        // Build a bitmap of the physical frames held.
+        uint32 lo = ~0U, hi = 0;
+        for (uint32 i = 0; i < nbatch; i++)
+            for (uint32 j = 0; j < batches[i].count; j++) {
+                uint32 frame = batches[i].pages[j].physLoc / PAGE_SIZE;
+                if (frame < lo)
+                    lo = frame;
+                if (frame > hi)
+                    hi = frame;
+            }
+        uint32 bits = hi - lo + 1;
+        free(bitmap);
+        bitmap = (uint32 *)calloc(BITMAPSIZE(bits), sizeof(uint32));
+        if (! bitmap)
+            break;
+        for (uint32 i = 0; i < nbatch; i++)
+            for (uint32 j = 0; j < batches[i].count; j++)
+                SETBIT(bitmap, batches[i].pages[j].physLoc / PAGE_SIZE - lo);
+
+        int start = findBitRun(bitmap, bits, pageCount);
+        if (start < 0)
+            continue;
+
+        // Success - keep the batches holding pages of the run and
+        // release all the others.  A batch is a single file mapping
+        // that can only be released as a whole, so the pages of a
+        // kept batch outside the run stay allocated until
+        // freeContPages (at worst about as many again as the run).
+        struct continuousPageInfo *ci = (struct continuousPageInfo *)malloc(
+            size_continuousPageInfo(nbatch));
         if (! ci)
-            goto fail;
-        ci->rawdata = allocPages(ci->pages, trycount);
-        if (! ci->rawdata)
-            goto fail;
-
-        // Sort the pages by physical location.
-        qsort(ci->pages, trycount, sizeof(ci->pages[0]), physPageComp);
-
-        // See if a continuous range with sufficient size exists.
-        uint32 cont=1;
-        for (uint i=1; i<trycount; i++) {
-            if (ci->pages[i].physLoc != ci->pages[i-1].physLoc + PAGE_SIZE) {
-                cont = 1;
-                continue;
+            break;
+        uint32 first = (lo + start) * PAGE_SIZE, held = 0;
+        ci->count = 0;
+        for (uint32 i = 0; i < nbatch; i++) {
+            struct pageBatch *b = &batches[i];
+            int keep = 0;
+            for (uint32 j = 0; j < b->count; j++) {
+                if (! IN_RANGE(b->pages[j].physLoc, first, pageCount * PAGE_SIZE))
+                    continue;
+                keep = 1;
+                if (b->pages[j].physLoc == first)
+                    data = b->pages[j].virtLoc;
             }
-            cont++;
-            if (cont >= pageCount) {
-                // Success.
-                Output("Found %d continuous pages by allocating %d virtual pages"
-                       , pageCount, trycount);
-                *info = ci;
-                return ci->pages[i-(pageCount-1)].virtLoc;
+            if (keep) {
+                held += b->count;
+                ci->rawdata[ci->count++] = b->rawdata;
+                b->rawdata = NULL;
             }
         }
-
-        // Failed to find the continuous pages - retry with larger size.
-        fcp_emulate(ci);
-        trycount *= 2;
+        Output("Found %d continuous pages after %d attempts"
+               " (%d pages allocated, %d of %d batches kept"
+               " holding %d pages outside the run)"
+               , pageCount, nbatch, total, ci->count, nbatch
+               , held - pageCount);
+        *info = ci;
+        break;
     }
 
 fail:
-    // Allocation failed
-    Output("Unable to find %d continuous pages", pageCount);
-    fcp_emulate(ci);
-    *info = NULL;
-    return NULL;
+    if (! data)
+        Output("Unable to find %d continuous pages", pageCount);
+    free(bitmap);
+    for (uint32 i = 0; i < nbatch; i++) {
+        if (batches[i].rawdata)
+            freePages(batches[i].rawdata);
+        free(batches[i].pages);
+    }
+    return data;
 }
 
 LATE_LOAD(AllocPhysMem, "coredll")
@@ -921,6 +1883,323 @@ allocContPages(int pageCount, struct continuousPageInfo **info)
 }
 
 
+/****************************************************************
+ * Bulk physical memory transfers
+ ****************************************************************/
+
+static uint32 PhysCachedRead = 1;
+REG_VAR_INT(0, "PHYSCACHEDREAD", PhysCachedRead
+            , "Read RAM through the kernel's cached mappings in bulk"
+              " transfers (0 to disable)")
+
+// Return how much of a transfer at 'paddr' should be mapped at once -
+// up to the end of a 1MB section when one is available, otherwise up
+// to the end of a VirtualCopy cache window.
+static uint32
+physChunk(uint32 paddr, uint32 len, int cached = 0)
+{
+    uint32 max;
+    if ((PhysicalMapMethod & 1) && memPhysMap_section(paddr, cached)) {
+        max = (1 << 20) - (paddr & ((1 << 20) - 1));
+    } else {
+        EnterCriticalSection(&PhysLock);
+        if (!physCacheSetup())
+            max = PhysWinSize - (paddr & ((PhysWinSize >> 1) - 1));
+        else
+            max = PAGE_SIZE - (paddr & (PAGE_SIZE - 1));
+        LeaveCriticalSection(&PhysLock);
+    }
+    return len < max ? len : max;
+}
+
+// Copy words between two mappings using eight register bursts.
+static void
+physBurstCopy(uint32 *dst, const uint32 *src, uint32 words)
+{
+    for (; words >= 8; words -= 8)
+        asm volatile("ldmia %1!, {r3-r6}\n"
+                     "stmia %0!, {r3-r6}\n"
+                     "ldmia %1!, {r3-r6}\n"
+                     "stmia %0!, {r3-r6}"
+                     : "+r" (dst), "+r" (src)
+                     : : "r3", "r4", "r5", "r6", "memory");
+    while (words--)
+        *dst++ = *src++;
+}
+
+// Copy a block between two mappings.  Returns false if an exception
+// occurred.
+static bool
+physCopyChunk(uint8 *dst, const uint8 *src, uint32 len)
+{
+    TRY_EXCEPTION_HANDLER {
+        if (!(((uint32)dst | (uint32)src) & 3)) {
+            physBurstCopy((uint32*)dst, (const uint32*)src, len / 4);
+            dst += len & ~3;
+            src += len & ~3;
+            len &= 3;
+        }
+        while (len--)
+            *dst++ = *src++;
+    } CATCH_EXCEPTION_HANDLER {
+        return false;
+    }
+    return true;
+}
+
+void
+fillPatternInit(struct fillPattern *pat, int wordsize, uint32 value)
+{
+    memset(pat, 0, sizeof(*pat));
+    pat->wordsize = wordsize;
+    pat->count = 1;
+    pat->values[0] = value;
+}
+
+// Store a 16 byte block repeatedly using eight register bursts.
+static void
+fillBurst(uint32 *dst, uint32 words, const uint32 *block)
+{
+    uint32 bursts = words / 8;
+    if (bursts)
+        asm volatile("ldmia %2, {r3-r6}\n"
+                     "1:\n"
+                     "stmia %0!, {r3-r6}\n"
+                     "stmia %0!, {r3-r6}\n"
+                     "subs %1, %1, #1\n"
+                     "bne 1b"
+                     : "+r" (dst), "+r" (bursts)
+                     : "r" (block)
+                     : "r3", "r4", "r5", "r6", "cc", "memory");
+    for (uint32 i = 0; i < (words & 7); i++)
+        *dst++ = block[i & 3];
+}
+
+// Return the next value of a pattern.
+static inline uint32
+fillNext(struct fillPattern *pat)
+{
+    uint32 v = pat->values[pat->pos] + pat->offset;
+    if (++pat->pos >= pat->count) {
+        pat->pos = 0;
+        pat->offset += pat->step;
+    }
+    return v;
+}
+
+// Store 'count' elements one at a time.
+static void
+fillElements(uint8 *dst, uint32 addr, uint32 count, struct fillPattern *pat)
+{
+    switch (pat->wordsize) {
+    case MO_SIZE8:
+        if (pat->addrdata)
+            for (; count; count--)
+                *dst++ = addr++;
+        else
+            for (; count; count--)
+                *dst++ = fillNext(pat);
+        break;
+    case MO_SIZE16: {
+        uint16 *d = (uint16*)dst;
+        if (pat->addrdata)
+            for (; count; count--, addr += 2)
+                *d++ = addr;
+        else
+            for (; count; count--)
+                *d++ = fillNext(pat);
+        break;
+    }
+    default: {
+        uint32 *d = (uint32*)dst;
+        if (pat->addrdata) {
+            for (; count >= 4; count -= 4, addr += 16) {
+                d[0] = addr;
+                d[1] = addr + 4;
+                d[2] = addr + 8;
+                d[3] = addr + 12;
+                d += 4;
+            }
+            for (; count; count--, addr += 4)
+                *d++ = addr;
+        } else if (pat->count == 1 && !pat->step) {
+            uint32 v = pat->values[0];
+            while (count--)
+                *d++ = v;
+        } else {
+            for (; count; count--)
+                *d++ = fillNext(pat);
+        }
+        break;
+    }
+    }
+}
+
+// Fill 'len' bytes at 'dst' (whose address is 'addr' for address
+// patterns).  Fixed patterns that evenly divide 16 bytes are expanded
+// to a block and stored with register bursts once 'dst' is aligned.
+static void
+fillChunk(uint8 *dst, uint32 addr, uint32 len, struct fillPattern *pat)
+{
+    uint32 esize = 1 << pat->wordsize, pbytes = pat->count * esize;
+    if (pat->addrdata || pat->step || (16 % pbytes)
+        || ((uint32)dst & (esize - 1)) || len < 32) {
+        fillElements(dst, addr, len / esize, pat);
+        return;
+    }
+    uint32 head = (-(uint32)dst) & 3;
+    fillElements(dst, addr, head / esize, pat);
+    dst += head;
+    len -= head;
+
+    union {
+        uint8 b[16];
+        uint16 h[8];
+        uint32 w[4];
+    } block;
+    uint32 pos = pat->pos;
+    for (uint32 i = 0; i < 16 / esize; i++) {
+        uint32 v = pat->values[(pos + i) % pat->count];
+        switch (pat->wordsize) {
+        case MO_SIZE8: block.b[i] = v; break;
+        case MO_SIZE16: block.h[i] = v; break;
+        default: block.w[i] = v; break;
+        }
+    }
+    uint32 words = len / 4;
+    fillBurst((uint32*)dst, words, block.w);
+    pat->pos = (pos + words * 4 / esize) % pat->count;
+    fillElements(dst + words * 4, addr, (len & 3) / esize, pat);
+}
+
+// Fill 'len' bytes of virtual memory at 'vaddr' with a pattern.
+// Returns false if an exception occurred.
+bool
+memFillBlock(uint8 *vaddr, uint32 len, struct fillPattern *pat)
+{
+    TRY_EXCEPTION_HANDLER {
+        fillChunk(vaddr, (uint32)vaddr, len, pat);
+    } CATCH_EXCEPTION_HANDLER {
+        return false;
+    }
+    return true;
+}
+
+// Fill 'len' bytes of physical memory at 'paddr' with a pattern.
+// Returns the number of bytes filled.
+uint32
+memPhysFillBlock(uint32 paddr, uint32 len, struct fillPattern *pat)
+{
+    uint32 done = 0, emask = (1 << pat->wordsize) - 1;
+    while (done < len) {
+        // Don't split an element between two mappings.
+        uint32 sz = physChunk(paddr + done, len - done);
+        if (sz > emask)
+            sz &= ~emask;
+        struct physMapping pm;
+        uint8 *dst = physMapRange(&pm, paddr + done, sz, 0, 1);
+        if (!dst)
+            break;
+        bool ok = true;
+        TRY_EXCEPTION_HANDLER {
+            fillChunk(dst, paddr + done, sz, pat);
+        } CATCH_EXCEPTION_HANDLER {
+            ok = false;
+        }
+        memPhysUnmap(&pm);
+        if (!ok)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+// Prepare for a series of memPhysReadBlock calls.  RAM is read
+// through the kernel's cached mappings, so lines dirtied through other
+// aliases are written back, and stale lines dropped, first.  This
+// flushes the whole cache (with interrupts off) - commands call it
+// once before reading a range, not once per block.
+void
+memPhysReadSync()
+{
+    if (!PhysCachedRead)
+        return;
+    take_control();
+    Mach->flushCache();
+    return_control();
+}
+
+// Copy 'len' bytes of physical memory at 'paddr' to 'dst'.  Returns
+// the number of bytes copied - less than 'len' if part of the range
+// could not be mapped or accessing it caused an exception.  See
+// memPhysReadSync.
+uint32
+memPhysReadBlock(void *dst, uint32 paddr, uint32 len)
+{
+    uint32 done = 0;
+    while (done < len) {
+        // Memory the kernel maps cached (ie, RAM) is read through that
+        // cached mapping - peripherals are always read uncached.
+        int cached = (PhysCachedRead && (PhysicalMapMethod & 1)
+                      && memPhysMap_section(paddr + done, 1));
+        uint32 sz = physChunk(paddr + done, len - done, cached);
+        struct physMapping pm;
+        uint8 *src = physMapRange(&pm, paddr + done, sz, cached, 1);
+        if (!src)
+            break;
+        bool ok = physCopyChunk((uint8*)dst + done, src, sz);
+        memPhysUnmap(&pm);
+        if (!ok)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+// Copy 'len' bytes from 'src' to physical memory at 'paddr'.  Returns
+// the number of bytes copied.
+uint32
+memPhysWriteBlock(uint32 paddr, const void *src, uint32 len)
+{
+    uint32 done = 0;
+    while (done < len) {
+        uint32 sz = physChunk(paddr + done, len - done);
+        struct physMapping pm;
+        uint8 *dst = physMapRange(&pm, paddr + done, sz, 0, 1);
+        if (!dst)
+            break;
+        bool ok = physCopyChunk(dst, (const uint8*)src + done, sz);
+        memPhysUnmap(&pm);
+        if (!ok)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+// Copy 'len' bytes of physical memory from 'src' to 'dst'.  Returns
+// the number of bytes copied.
+uint32
+memPhysCopy(uint32 dst, uint32 src, uint32 len)
+{
+    uint32 done = 0;
+    while (done < len) {
+        uint32 sz = physChunk(src + done, len - done);
+        sz = physChunk(dst + done, sz);
+        struct physMapping spm, dpm;
+        uint8 *s = physMapRange(&spm, src + done, sz, 0, 1);
+        uint8 *d = physMapRange(&dpm, dst + done, sz, 0, 1);
+        bool ok = s && d && physCopyChunk(d, s, sz);
+        memPhysUnmap(&dpm);
+        memPhysUnmap(&spm);
+        if (!ok)
+            break;
+        done += sz;
+    }
+    return done;
+}
+
+
 /****************************************************************
  * Misc utilities
  ****************************************************************/
@@ -0,0 +1,113 @@
+/* Pattern search engine used by PSEARCH and VSEARCH.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+// Nothing here touches the device - the host test (see "make
+// searchtest") runs this file against the physical memory simulator.
+
+#include <string.h> // memcmp, memmove
+
+#include "xtypes.h"
+#include "memsearch.h"
+
+void
+searchPrepare(struct searchPattern *sp)
+{
+    uint32 m, j;
+    if (!sp->isWord) {
+        m = sp->len;
+        for (j = 0; j < 256; j++)
+            sp->shift[j] = m;
+        for (j = 0; j < m - 1; j++)
+            sp->shift[sp->bytes[j]] = m - 1 - j;
+        return;
+    }
+    // Words whose mask doesn't cover the low byte match anything, so
+    // no shift may move past them.
+    m = sp->len / 4;
+    uint32 cap = m;
+    for (j = 0; j < m - 1; j++)
+        if ((sp->masks[j] & 0xff) != 0xff)
+            cap = m - 1 - j;
+    for (j = 0; j < 256; j++)
+        sp->shift[j] = cap;
+    for (j = 0; j < m - 1; j++)
+        if ((sp->masks[j] & 0xff) == 0xff && m - 1 - j < cap)
+            sp->shift[sp->words[j] & 0xff] = m - 1 - j;
+}
+
+void
+searchBlock(struct searchPattern *sp, const uint8 *buf, uint32 from
+            , uint32 avail, uint32 base)
+{
+    if (!sp->isWord) {
+        uint32 m = sp->len;
+        uint8 lastc = sp->bytes[m - 1];
+        for (uint32 pos = from; pos + m <= avail; ) {
+            uint8 c = buf[pos + m - 1];
+            if (c == lastc && !memcmp(&buf[pos], sp->bytes, m - 1))
+                sp->hit(sp, base + pos);
+            pos += sp->shift[c];
+        }
+        return;
+    }
+
+    const uint32 *wbuf = (const uint32 *)buf;
+    uint32 m = sp->len / 4, i = from / 4, last = (avail - sp->len) / 4;
+    if (m == 1) {
+        // Plain word at a time compare
+        uint32 pat = sp->words[0], mask = sp->masks[0];
+        for (; i <= last; i++)
+            if ((wbuf[i] & mask) == pat)
+                sp->hit(sp, base + i * 4);
+        return;
+    }
+    while (i <= last) {
+        uint32 w = wbuf[i + m - 1];
+        if ((w & sp->masks[m - 1]) == sp->words[m - 1]) {
+            uint32 j;
+            for (j = 0; j < m - 1; j++)
+                if ((wbuf[i + j] & sp->masks[j]) != sp->words[j])
+                    break;
+            if (j == m - 1)
+                sp->hit(sp, base + i * 4);
+        }
+        i += sp->shift[w & 0xff];
+    }
+}
+
+uint32
+searchRange(struct searchPattern *sp, uint32 start, uint32 size
+            , uint8 *buf, uint32 bufsize, searchReadFunc read
+            , void (*progress)(uint32 done))
+{
+    searchPrepare(sp);
+    sp->count = 0;
+
+    uint32 step = sp->isWord ? 4 : 1;
+    uint32 keep = 0, from = 0, done = 0;
+    while (done < size) {
+        if (progress)
+            progress(done);
+        uint32 want = bufsize - keep;
+        if (want > size - done)
+            want = size - done;
+        uint32 got = read(buf + keep, start + done, want);
+        uint32 avail = keep + got, base = start + done - keep;
+        uint32 next = from;
+        if (avail >= sp->len) {
+            searchBlock(sp, buf, from, avail, base);
+            next = (avail - sp->len) / step * step + step;
+        }
+        done += got;
+        if (got != want)
+            break;
+        // Keep the bytes that may start a match spanning into the
+        // next block (the buffer stays word aligned).
+        keep = avail - (next & ~3);
+        memmove(buf, buf + (next & ~3), keep);
+        from = next & 3;
+    }
+    return done;
+}
@@ -0,0 +1,232 @@
+/* Snapshots of physical memory and reports of what changed since.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#include <windows.h>
+#include <stdio.h> // FILE, _snprintf
+#include <stdlib.h> // malloc
+#include <string.h> // memcmp
+
+#include "xtypes.h"
+#include "output.h" // Output
+#include "memory.h" // memPhysReadBlock, memPhysReadSync
+#include "script.h" // REG_CMD
+#include "cpu.h" // PAGE_SIZE
+#include "resource.h" // DLG_PROGRESS
+
+// Largest number of changed words in a page that are listed
+// individually by MEMDIFF.
+#define SNAP_MAXDELTAS 8
+
+// Where a snapshot keeps the page contents (if anywhere).
+enum {
+    SNAP_HASHONLY = 0,
+    SNAP_MEMORY = 1,
+    SNAP_FILE = 2,
+};
+
+struct memSnapshot {
+    struct memSnapshot *next;
+    char name[32];
+    uint32 addr, pages;
+    int keep;
+    uint32 *hashes;
+    uint8 *data;
+    FILE *f;
+};
+
+static struct memSnapshot *Snapshots;
+
+// FNV style hash of a page - one multiply per word.
+static uint32
+pageHash(const uint32 *p)
+{
+    uint32 h = 0x811c9dc5;
+    for (uint32 i = 0; i < PAGE_SIZE / 4; i++)
+        h = (h ^ p[i]) * 0x01000193;
+    return h;
+}
+
+static struct memSnapshot **
+findSnapshot(const char *name)
+{
+    struct memSnapshot **ps = &Snapshots;
+    while (*ps && _stricmp((*ps)->name, name))
+        ps = &(*ps)->next;
+    return ps;
+}
+
+static void
+freeSnapshot(struct memSnapshot **ps)
+{
+    struct memSnapshot *s = *ps;
+    *ps = s->next;
+    if (s->f)
+        fclose(s->f);
+    free(s->data);
+    free(s->hashes);
+    free(s);
+}
+
+static void
+cmd_snapshot(const char *cmd, const char *args)
+{
+    char name[32];
+    if (get_token(&args, name, sizeof(name))) {
+        ScriptError("Expected <name>");
+        return;
+    }
+    struct memSnapshot **ps = findSnapshot(name);
+    uint32 addr, size, keep;
+    if (!get_expression(&args, &addr)) {
+        // Only a name - just drop the snapshot.
+        if (*ps)
+            freeSnapshot(ps);
+        return;
+    }
+    if (!get_expression(&args, &size)) {
+        ScriptError("Expected <name> <addr> <size> [<keep>]");
+        return;
+    }
+    if (!size) {
+        ScriptError("Nothing to snapshot");
+        return;
+    }
+    if (!get_expression(&args, &keep))
+        keep = SNAP_HASHONLY;
+    if (keep > SNAP_FILE) {
+        ScriptError("<keep> must be 0, 1 or 2");
+        return;
+    }
+    if (*ps)
+        freeSnapshot(ps);
+
+    struct memSnapshot *s = (struct memSnapshot *)calloc(1, sizeof(*s));
+    if (!s) {
+        Output(C_ERROR "Failed to allocate snapshot");
+        return;
+    }
+    strcpy(s->name, name);
+    s->addr = addr & ~(PAGE_SIZE - 1);
+    s->pages = (PAGE_ALIGN(addr + size) - s->addr) / PAGE_SIZE;
+    s->keep = keep;
+    s->hashes = (uint32 *)malloc(s->pages * sizeof(s->hashes[0]));
+    s->next = Snapshots;
+    Snapshots = s;
+    if (!s->hashes) {
+        Output(C_ERROR "Failed to allocate snapshot");
+        freeSnapshot(&Snapshots);
+        return;
+    }
+    if (keep == SNAP_MEMORY) {
+        s->data = (uint8 *)malloc(s->pages * PAGE_SIZE);
+        if (!s->data) {
+            Output(C_WARN "Not enough memory to keep the page contents"
+                   " - only page hashes are stored");
+            s->keep = SNAP_HASHONLY;
+        }
+    } else if (keep == SNAP_FILE) {
+        char rawfn[64], fn[MAX_CMDLEN];
+        _snprintf(rawfn, sizeof(rawfn), "snap-%s.bin", name);
+        fnprepare(rawfn, fn, sizeof(fn));
+        s->f = fopen(fn, "w+b");
+        if (!s->f) {
+            Output(C_ERROR "Cannot write file %s", fn);
+            freeSnapshot(&Snapshots);
+            return;
+        }
+    }
+
+    uint32 page[PAGE_SIZE / 4];
+    memPhysReadSync();
+    InitProgress(DLG_PROGRESS, s->pages);
+    for (uint32 i = 0; i < s->pages; i++) {
+        SetProgress(i);
+        uint32 paddr = s->addr + i * PAGE_SIZE;
+        if (memPhysReadBlock(page, paddr, PAGE_SIZE) != PAGE_SIZE) {
+            Output(C_ERROR "Unable to read physical address %08x", paddr);
+            freeSnapshot(&Snapshots);
+            break;
+        }
+        s->hashes[i] = pageHash(page);
+        if (s->data)
+            memcpy(&s->data[i * PAGE_SIZE], page, PAGE_SIZE);
+        if (s->f && fwrite(page, PAGE_SIZE, 1, s->f) != 1) {
+            Output(C_ERROR "Short write detected while writing to file");
+            freeSnapshot(&Snapshots);
+            break;
+        }
+    }
+    DoneProgress();
+}
+REG_CMD(0, "SNAPSHOT", cmd_snapshot,
+        "SNAPSHOT <name> [<addr> <size> [<keep>]]\n"
+        "  Record a hash of each page of physical memory in the given\n"
+        "  range, for use by MEMDIFF.  With <keep> 1 the page contents\n"
+        "  are also kept in memory, with <keep> 2 in the file\n"
+        "  snap-<name>.bin - MEMDIFF then shows which words changed.\n"
+        "  Without a range the named snapshot is discarded.")
+
+// Report the words that differ between two copies of a page.
+static void
+pageDeltas(uint32 paddr, const uint32 *old, const uint32 *cur)
+{
+    uint32 count = 0;
+    for (uint32 i = 0; i < PAGE_SIZE / 4; i++)
+        if (old[i] != cur[i])
+            count++;
+    if (count > SNAP_MAXDELTAS) {
+        Output("  %d words changed", count);
+        return;
+    }
+    for (uint32 i = 0; i < PAGE_SIZE / 4; i++)
+        if (old[i] != cur[i])
+            Output("  %08x: %08x -> %08x", paddr + i * 4, old[i], cur[i]);
+}
+
+static void
+cmd_memdiff(const char *cmd, const char *args)
+{
+    char name[32];
+    if (get_token(&args, name, sizeof(name))) {
+        ScriptError("Expected <name>");
+        return;
+    }
+    struct memSnapshot *s = *findSnapshot(name);
+    if (!s) {
+        ScriptError("Unknown snapshot '%s'", name);
+        return;
+    }
+
+    uint32 page[PAGE_SIZE / 4], old[PAGE_SIZE / 4];
+    uint32 changed = 0;
+    memPhysReadSync();
+    InitProgress(DLG_PROGRESS, s->pages);
+    for (uint32 i = 0; i < s->pages; i++) {
+        SetProgress(i);
+        uint32 paddr = s->addr + i * PAGE_SIZE;
+        if (memPhysReadBlock(page, paddr, PAGE_SIZE) != PAGE_SIZE) {
+            Output(C_ERROR "Unable to read physical address %08x", paddr);
+            continue;
+        }
+        if (pageHash(page) == s->hashes[i])
+            continue;
+        changed++;
+        Output("Page %08x changed", paddr);
+        if (s->data) {
+            pageDeltas(paddr, (uint32 *)&s->data[i * PAGE_SIZE], page);
+        } else if (s->f) {
+            if (fseek(s->f, i * PAGE_SIZE, SEEK_SET)
+                || fread(old, PAGE_SIZE, 1, s->f) != 1)
+                Output(C_ERROR "Unable to read page from snapshot file");
+            else
+                pageDeltas(paddr, old, page);
+        }
+    }
+    DoneProgress();
+    Output("%d of %d pages changed", changed, s->pages);
+}
+REG_CMD(0, "MEMDIFF", cmd_memdiff,
+        "MEMDIFF <name>\n"
+        "  Report the pages that changed since the given SNAPSHOT.")
@@ -0,0 +1,398 @@
+/* Test of physical RAM from WinCE.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#include <windows.h> // GetTickCount
+#include <stdlib.h> // malloc, qsort
+
+#include "xtypes.h"
+#include "output.h" // Output
+#include "memory.h" // allocPages, memPhysMapRange
+#include "script.h" // REG_CMD
+#include "cpu.h" // PAGE_SIZE, take_control
+#include "machines.h" // Mach
+#include "exceptions.h" // TRY_EXCEPTION_HANDLER
+#include "resource.h" // DLG_PROGRESS
+
+// Pages allocated at a time while collecting the pages of the range
+#define MEMTEST_CHUNK 256
+// Largest run of physically continuous pages mapped at once
+#define MEMTEST_MAXRUN (1 << 20)
+// Number of failing words reported per test
+#define MEMTEST_MAXREPORT 16
+
+static uint32 MemTestMaxAlloc = 32 * 1024 * 1024;
+REG_VAR_INT(0, "MEMTESTALLOC", MemTestMaxAlloc,
+            "Most memory MEMTEST allocates while looking for free pages"
+            " in the range to test")
+
+// A run of physically continuous pages under test.
+struct memTestRun {
+    uint32 paddr, size;
+    volatile uint32 *vaddr;
+    struct physMapping pm;
+};
+
+struct memTest {
+    struct memTestRun *runs;
+    uint32 count;
+    // Results of the current test
+    uint32 errors, badbits;
+};
+
+static void
+testFail(struct memTest *t, uint32 paddr, uint32 expect, uint32 got)
+{
+    if (t->errors++ < MEMTEST_MAXREPORT)
+        Output("  %08x: expected %08x got %08x (bits %08x)"
+               , paddr, expect, got, expect ^ got);
+    t->badbits |= expect ^ got;
+}
+
+// Check that a run holds 'v' in every word, reading four words at a
+// time.
+static void
+checkConst(struct memTest *t, struct memTestRun *r, uint32 v)
+{
+    volatile uint32 *p = r->vaddr;
+    uint32 words = r->size / 4;
+    for (uint32 i = 0; i < words; i += 4) {
+        uint32 diff;
+        asm volatile("ldmia %1, {r3-r6}\n"
+                     "eor r3, r3, %2\n"
+                     "eor r4, r4, %2\n"
+                     "orr r3, r3, r4\n"
+                     "eor r5, r5, %2\n"
+                     "orr r3, r3, r5\n"
+                     "eor r6, r6, %2\n"
+                     "orr %0, r3, r6"
+                     : "=r" (diff)
+                     : "r" (&p[i]), "r" (v)
+                     : "r3", "r4", "r5", "r6", "memory");
+        if (diff)
+            for (uint32 j = i; j < i + 4; j++)
+                if (p[j] != v)
+                    testFail(t, r->paddr + j * 4, v, p[j]);
+    }
+}
+
+// Store 'words' (a multiple of 4) words from 'src' four at a time.
+static void
+burstStore(volatile uint32 *dst, const uint32 *src, uint32 words)
+{
+    for (; words; words -= 4)
+        asm volatile("ldmia %1!, {r3-r6}\n"
+                     "stmia %0!, {r3-r6}"
+                     : "+r" (dst), "+r" (src)
+                     :
+                     : "r3", "r4", "r5", "r6", "memory");
+}
+
+// Check that the 'words' (a multiple of 4) words of a run starting at
+// word 'first' match 'expect', reading four words at a time.
+static void
+burstCheck(struct memTest *t, struct memTestRun *r, uint32 first
+           , const uint32 *expect, uint32 words)
+{
+    volatile uint32 *p = &r->vaddr[first];
+    for (uint32 i = 0; i < words; i += 4) {
+        uint32 diff;
+        asm volatile("ldmia %1, {r3-r6}\n"
+                     "ldr %0, [%2]\n"
+                     "eor r3, r3, %0\n"
+                     "ldr %0, [%2, #4]\n"
+                     "eor r4, r4, %0\n"
+                     "orr r3, r3, r4\n"
+                     "ldr %0, [%2, #8]\n"
+                     "eor r5, r5, %0\n"
+                     "orr r3, r3, r5\n"
+                     "ldr %0, [%2, #12]\n"
+                     "eor r6, r6, %0\n"
+                     "orr %0, r3, r6"
+                     : "=&r" (diff)
+                     : "r" (&p[i]), "r" (&expect[i])
+                     : "r3", "r4", "r5", "r6", "memory");
+        if (diff)
+            for (uint32 j = i; j < i + 4; j++)
+                if (p[j] != expect[j])
+                    testFail(t, r->paddr + (first + j) * 4, expect[j], p[j]);
+    }
+}
+
+// Words of a test pattern generated at a time (runs are a multiple)
+#define MEMTEST_BLOCK 32
+
+// Walking ones and zeros - each word has one bit set (or cleared),
+// moving up one bit per word.  Returns the number of bytes accessed.
+static uint32
+testWalking(struct memTest *t, uint32 pass)
+{
+    uint32 block[MEMTEST_BLOCK];
+    for (uint32 inv = 0; inv <= 1; inv++) {
+        uint32 x = inv ? 0xffffffff : 0;
+        // The pattern repeats every 32 words.
+        for (uint32 i = 0; i < MEMTEST_BLOCK; i++)
+            block[i] = (1 << ((i + pass) & 31)) ^ x;
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK)
+                burstStore(&r->vaddr[i], block, MEMTEST_BLOCK);
+        }
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK)
+                burstCheck(t, r, i, block, MEMTEST_BLOCK);
+        }
+    }
+    return 4;
+}
+
+// Build the address test values of the block at 'paddr'.
+static void
+addressBlock(uint32 *block, uint32 paddr, uint32 x)
+{
+    for (uint32 i = 0; i < MEMTEST_BLOCK; i++)
+        block[i] = (paddr + i * 4) ^ x;
+}
+
+// Each word holds its own physical address (and then its inverse).
+static uint32
+testAddress(struct memTest *t, uint32 pass)
+{
+    uint32 block[MEMTEST_BLOCK];
+    for (uint32 inv = 0; inv <= 1; inv++) {
+        uint32 x = inv ? 0xffffffff : 0;
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK) {
+                addressBlock(block, r->paddr + i * 4, x);
+                burstStore(&r->vaddr[i], block, MEMTEST_BLOCK);
+            }
+        }
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK) {
+                addressBlock(block, r->paddr + i * 4, x);
+                burstCheck(t, r, i, block, MEMTEST_BLOCK);
+            }
+        }
+    }
+    return 4;
+}
+
+// Moving inversions - fill with a pattern, then check and invert each
+// word going up, and check and restore each word going down.  The
+// up and down sweeps must visit one word at a time, so only the fill
+// and the final check use bursts.
+static uint32
+testInversions(struct memTest *t, uint32 pass)
+{
+    static const uint32 patterns[] = { 0x00000000, 0x55555555 };
+    for (uint32 k = 0; k < ARRAY_SIZE(patterns); k++) {
+        uint32 v = patterns[k] ^ (pass & 1 ? 0xffffffff : 0);
+        struct fillPattern pat;
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            fillPatternInit(&pat, MO_SIZE32, v);
+            memFillBlock((uint8*)r->vaddr, r->size, &pat);
+        }
+        for (uint32 n = 0; n < t->count; n++) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = 0; i < r->size / 4; i++) {
+                uint32 got = r->vaddr[i];
+                if (got != v)
+                    testFail(t, r->paddr + i * 4, v, got);
+                r->vaddr[i] = ~v;
+            }
+        }
+        for (uint32 n = t->count; n--; ) {
+            struct memTestRun *r = &t->runs[n];
+            for (uint32 i = r->size / 4; i--; ) {
+                uint32 got = r->vaddr[i];
+                if (got != ~v)
+                    testFail(t, r->paddr + i * 4, ~v, got);
+                r->vaddr[i] = v;
+            }
+        }
+        for (uint32 n = 0; n < t->count; n++)
+            checkConst(t, &t->runs[n], v);
+    }
+    return 2 * 6;
+}
+
+// Build the next block of random test values.
+static void
+randomBlock(uint32 *block, uint32 *x)
+{
+    for (uint32 i = 0; i < MEMTEST_BLOCK; i++) {
+        *x = *x * 1664525 + 1013904223;
+        block[i] = *x;
+    }
+}
+
+// Pseudo random data, regenerated for the check.
+static uint32
+testRandom(struct memTest *t, uint32 pass)
+{
+    uint32 block[MEMTEST_BLOCK];
+    uint32 seed = 0x12345678 + pass * 0x9e3779b9, x = seed;
+    for (uint32 n = 0; n < t->count; n++) {
+        struct memTestRun *r = &t->runs[n];
+        for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK) {
+            randomBlock(block, &x);
+            burstStore(&r->vaddr[i], block, MEMTEST_BLOCK);
+        }
+    }
+    x = seed;
+    for (uint32 n = 0; n < t->count; n++) {
+        struct memTestRun *r = &t->runs[n];
+        for (uint32 i = 0; i < r->size / 4; i += MEMTEST_BLOCK) {
+            randomBlock(block, &x);
+            burstCheck(t, r, i, block, MEMTEST_BLOCK);
+        }
+    }
+    return 2;
+}
+
+static struct {
+    const char *name;
+    // Returns the number of times the memory was read or written
+    uint32 (*func)(struct memTest *t, uint32 pass);
+} MemTests[] = {
+    { "walking ones/zeros", testWalking },
+    { "address as data", testAddress },
+    { "moving inversions", testInversions },
+    { "random data", testRandom },
+};
+
+static int
+cmpFrame(const void *a, const void *b)
+{
+    uint32 x = *(const uint32*)a, y = *(const uint32*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+cmd_memtest(const char *cmd, const char *args)
+{
+    uint32 start, size, passes;
+    if (!get_expression(&args, &start) || !get_expression(&args, &size)) {
+        ScriptError("Expected <start> <size> [<passes>]");
+        return;
+    }
+    if (!get_expression(&args, &passes))
+        passes = 1;
+    start &= ~(PAGE_SIZE - 1);
+    size = PAGE_ALIGN(size);
+    if (!size) {
+        ScriptError("Nothing to test");
+        return;
+    }
+
+    // Only pages the kernel hands to us can be overwritten - collect
+    // the free pages that are in the range.
+    uint32 want = size / PAGE_SIZE, found = 0, chunkCount = 0;
+    uint32 maxChunks = MemTestMaxAlloc / (MEMTEST_CHUNK * PAGE_SIZE) + 1;
+    uint32 *frames = (uint32*)malloc(want * sizeof(frames[0]));
+    void **chunks = (void**)malloc(maxChunks * sizeof(chunks[0]));
+    struct memTest t;
+    memset(&t, 0, sizeof(t));
+    t.runs = (struct memTestRun*)malloc(want * sizeof(t.runs[0]));
+    if (!frames || !chunks || !t.runs) {
+        Output(C_ERROR "Failed to allocate buffer");
+        goto out;
+    }
+    while (found < want && chunkCount < maxChunks) {
+        struct pageAddrs pages[MEMTEST_CHUNK];
+        void *data = allocPages(pages, MEMTEST_CHUNK);
+        if (!data)
+            break;
+        chunks[chunkCount++] = data;
+        for (int i = 0; i < MEMTEST_CHUNK && found < want; i++)
+            if (pages[i].physLoc - start < size)
+                frames[found++] = pages[i].physLoc;
+    }
+    if (!found) {
+        Output(C_ERROR "No free pages found in %08x-%08x"
+               , start, start + size - 1);
+        goto out;
+    }
+    // The kernel may have cleared the pages through a cached mapping -
+    // write those lines back before the pages are used uncached.
+    take_control();
+    Mach->flushCache();
+    return_control();
+
+    // Map the pages uncached, as runs of continuous pages.
+    qsort(frames, found, sizeof(frames[0]), cmpFrame);
+    for (uint32 i = 0; i < found; ) {
+        struct memTestRun *r = &t.runs[t.count];
+        r->paddr = frames[i];
+        r->size = 0;
+        while (i < found && frames[i] == r->paddr + r->size
+               && r->size < MEMTEST_MAXRUN) {
+            r->size += PAGE_SIZE;
+            i++;
+        }
+        r->vaddr = (uint32*)memPhysMapRange(&r->pm, r->paddr, r->size);
+        if (!r->vaddr) {
+            Output(C_WARN "Unable to map %08x - not tested", r->paddr);
+            continue;
+        }
+        t.count++;
+    }
+    Output("Testing %d of %d pages in %08x-%08x (%d runs)"
+           , found, want, start, start + size - 1, t.count);
+
+    {
+        uint32 tested = 0, total = 0, allbits = 0;
+        for (uint32 n = 0; n < t.count; n++)
+            tested += t.runs[n].size;
+        InitProgress(DLG_PROGRESS, passes * ARRAY_SIZE(MemTests));
+        for (uint32 pass = 0; pass < passes; pass++) {
+            for (uint32 k = 0; k < ARRAY_SIZE(MemTests); k++) {
+                SetProgress(pass * ARRAY_SIZE(MemTests) + k);
+                t.errors = t.badbits = 0;
+                uint32 starttime = GetTickCount(), sweeps = 0;
+                TRY_EXCEPTION_HANDLER {
+                    sweeps = MemTests[k].func(&t, pass);
+                } CATCH_EXCEPTION_HANDLER {
+                    Output(C_ERROR "EXCEPTION during %s test"
+                           , MemTests[k].name);
+                }
+                uint32 ms = GetTickCount() - starttime;
+                uint32 kb = tested / 1024 * sweeps;
+                Output("Pass %d %-20s %6d errors  %6d KB/s%s"
+                       , pass + 1, MemTests[k].name, t.errors
+                       , ms ? (uint32)((uint64)kb * 1000 / ms) : kb
+                       , t.errors ? "  FAILED" : "");
+                if (t.errors)
+                    Output("  failing bits %08x", t.badbits);
+                total += t.errors;
+                allbits |= t.badbits;
+            }
+        }
+        DoneProgress();
+        if (total)
+            Output(C_ERROR "MEMTEST found %d errors (bits %08x)"
+                   , total, allbits);
+        else
+            Output("MEMTEST passed");
+    }
+
+out:
+    for (uint32 n = 0; n < t.count; n++)
+        memPhysUnmap(&t.runs[n].pm);
+    for (uint32 i = 0; i < chunkCount; i++)
+        freePages(chunks[i]);
+    free(t.runs);
+    free(chunks);
+    free(frames);
+}
+REG_CMD(0, "MEMTEST", cmd_memtest,
+        "MEMTEST <start> <size> [<passes>]\n"
+        "  Test the physical RAM at <start>.  Only the pages in the range\n"
+        "  that can be allocated are tested (see MEMTESTALLOC) with\n"
+        "  walking ones/zeros, address as data, moving inversions and\n"
+        "  random data.  Failing addresses and bits are reported.")
@@ -14,8 +14,8 @@
 #include <windows.h> // for pkfuncs.h
 
 #include "output.h" // Output
-#include "memory.h" // memVirtToPhys
-#include "memcmds.h" // parseL1Entry
+#include "memory.h" // memVirtToPhys, memPhysReadSync
+#include "memcmds.h" // parseL1Entry, printMMUHeader
 #include "irq.h"
 #include "memcmds.h"
 
@@ -51,7 +51,8 @@ int prepMMUMerge(struct irqData *data)
 	
 	//make sure we have the mmu table address
 	if( !data->mmuVAddr ){
-		data->mmuVAddr = (uint32*)memPhysMap(cpuGetMMU());
+		data->mmuVAddr = (uint32*)memPhysMapRange(&data->mmuMap
+							  , cpuGetMMU(), 4096 * 4);
 		if (! data->mmuVAddr) {
 			Output("Unable to map MMU table");
 			data->mergeTableCount = 0; 
@@ -84,10 +85,10 @@ void __irq stopMMUMerge(struct irqData *data)
 void dumpMMUMerge(struct irqData *data){
 	if( !data->mergeTableCount ) return;
 
+	// The L2 tables are read through memPhysReadBlock.
+	memPhysReadSync();
 	Output("Dumping MMU Merge table (last change mappings):");
-        Output("  Virtual | Physical |   Description |  Flags");
-        Output("  address | address  |               |");
-        Output("----------+----------+---------------+----------------------");
+        printMMUHeader();
 	//now search the entire table, l1s and l2s, for anything in the range we're interested in
 	for(uint i=0;i < data->mergeTableCount;i++){
 		if(!data->l1Changed[i])continue;
@@ -14,6 +14,7 @@
 #include "terminal.h" // haretNetworkTerminal
 #include "script.h" // scrInterpret
 #include "machines.h" // Mach
+#include "memory.h" // memPhysThreadDone
 #include "network.h"
 
 #  include <winsock.h>
@@ -151,6 +152,7 @@ finish:
         so_close(lsock);
 
     Status(L"");
+    memPhysThreadDone();
 }
 
 void
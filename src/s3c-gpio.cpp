@@ -79,6 +79,16 @@ const unsigned char S3C6410_BANKS_STATES[8 * 17] = {
 /*Q*/ 'I', 'O', ' ', 'X',  '-', '-', '-', '-', //2:MEM0 
 };
         
+// Size of the gpio register block
+#define S3C_GPIO_SIZE 0x1000
+
+// Map the gpio register block - release it with memPhysUnmap().
+static uint32 *
+s3c_gpioMap(struct physMapping *pm)
+{
+  return (uint32 *)memPhysMapRange (pm, S3C6400_PA_GPIO, S3C_GPIO_SIZE);
+}
+
 //Sample: get 'A' for 0<=num<=7, 'B' for 8<=num<=14 
 uint32 s3c_int2bank(uint32 num)
 {
@@ -123,21 +133,27 @@ int s3c_gpioGetDir(int num)
   con_addr    = S3C6410_BANKS[B + S3C_BANK_CONREG];
   con_addr /= 4;
   
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);  
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+        return -1;
+
+  int dir = -1;
 
   //CON0
   if (con_dwords == 1 || gpio_offset < 8) {
     con_data0 = GPIO[con_addr];
-    return (con_data0 & con_mask0) >> gpio_offset * S3C6410_BANKS[B + S3C_BANK_CONPAD];
+    dir = (con_data0 & con_mask0) >> gpio_offset * S3C6410_BANKS[B + S3C_BANK_CONPAD];
   }
   
   //CON1 (for banks H,K,L)
-  if (con_dwords == 2 && gpio_offset >= 8) {
+  else if (con_dwords == 2 && gpio_offset >= 8) {
     con_data1 = GPIO[con_addr+1];
-    return (con_data1 & con_mask1) >> (gpio_offset-8) * S3C6410_BANKS[B + S3C_BANK_CONPAD]; 
+    dir = (con_data1 & con_mask1) >> (gpio_offset-8) * S3C6410_BANKS[B + S3C_BANK_CONPAD]; 
   }
   
-  return -1;
+  memPhysUnmap (&pm);
+  return dir;
 }
 
 void s3c_gpioSetDir(int num, int dir)
@@ -165,7 +181,10 @@ void s3c_gpioSetDir(int num, int dir)
         con_mask1   = pad_mask << (gpio_offset-8) * S3C6410_BANKS[B + S3C_BANK_CONPAD];
   
   con_addr    = S3C6410_BANKS[B + S3C_BANK_CONREG];
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);  
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+        return;
   con_addr /= 4;
   
   dir &= pad_mask;
@@ -189,18 +208,22 @@ void s3c_gpioSetDir(int num, int dir)
     
     GPIO[con_addr+1] = con_data1;
   }
+  memPhysUnmap (&pm);
 }
 
 int s3c_gpioGetPUD(int num)
 {
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return -1;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return -1;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_PUDREG];
@@ -209,6 +232,7 @@ int s3c_gpioGetPUD(int num)
   mask = 0x3 << ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
   data = (data & mask) >> ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
 
+  memPhysUnmap (&pm);
   return data;
 }
 
@@ -216,14 +240,17 @@ void s3c_gpioSetPUD(int num, int state)
 {	
   state &= 0x3;
   
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_PUDREG];
@@ -236,19 +263,23 @@ void s3c_gpioSetPUD(int num, int state)
   data |= mask;
   
   GPIO[addr / 4] = data;
+  memPhysUnmap (&pm);
 
 }
 
 int s3c_gpioGetState(int num)
 {
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return -1;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return -1;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_DATREG];
@@ -257,19 +288,23 @@ int s3c_gpioGetState(int num)
   mask = 1 << (num - S3C6410_BANKS[B + S3C_BANK_GPIO]);
   data = ((data & mask) > 0);
 
+  memPhysUnmap (&pm);
   return data;
 }
 
 void s3c_gpioSetState(int num, int state)
 {
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_DATREG];
@@ -285,6 +320,7 @@ void s3c_gpioSetState(int num, int state)
     data = data & ~mask;
   
   GPIO[addr / 4] = data;
+  memPhysUnmap (&pm);
 }
 
 int s3c_gpioGetSleepDir (int num)
@@ -295,8 +331,11 @@ int s3c_gpioGetSleepDir (int num)
   bank = s3c_int2bank(num);
   if (bank==0)
      return -1;
-     
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return -1;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_SCONREG];
@@ -305,11 +344,12 @@ int s3c_gpioGetSleepDir (int num)
       
     mask = 0x3 << ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
     data = (data & mask) >> ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
-
-    return data;
+  } else {
+    data = 0;
   }
   
-  return 0;
+  memPhysUnmap (&pm);
+  return data;
 }
 
 void s3c_gpioSetSleepDir (int num, int state)
@@ -323,7 +363,10 @@ void s3c_gpioSetSleepDir (int num, int state)
   if (bank==0)
      return;
 
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_SCONREG];
@@ -338,19 +381,23 @@ void s3c_gpioSetSleepDir (int num, int state)
     
     GPIO[addr / 4] = data;
   }
+  memPhysUnmap (&pm);
 
 }
 
 int s3c_gpioGetSleepPUD(int num)
 {
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return -1;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return -1;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_SPUDREG];
@@ -359,25 +406,29 @@ int s3c_gpioGetSleepPUD(int num)
       
     mask = 0x3 << ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
     data = (data & mask) >> ((num - S3C6410_BANKS[B + S3C_BANK_GPIO])*2);
-
-    return data;
+  } else {
+    data = 0;
   }
   
-  return 0;
+  memPhysUnmap (&pm);
+  return data;
 }
 
 void s3c_gpioSetSleepPUD(int num, int state)
 {	
   state &= 0x3;
   
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
-
   uint B, bank;
   uint32 addr,data,mask;
   
   bank = s3c_int2bank(num);
   if (bank==0)
      return;
+
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+     return;
             
   B = (bank - 'A')*S3C_BANK_COLS;
   addr = S3C6410_BANKS[B + S3C_BANK_SPUDREG];
@@ -392,6 +443,7 @@ void s3c_gpioSetSleepPUD(int num, int state)
   
     GPIO[addr / 4] = data;
   }
+  memPhysUnmap (&pm);
 }
 
 // Watch for given number of seconds which GPIO pins change
@@ -409,7 +461,14 @@ static void s3c_gpioWatch (uint seconds)
   uint B, bank;
   uint32 addr,data; //,mask;
 
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
+  // The registers stay mapped for the whole watch
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+  {
+    Output(C_ERROR "Unable to map GPIO registers");
+    return;
+  }
   uint32 old_gpio[17];
   for (bank = 0; bank < 17; bank++) {
   
@@ -425,7 +484,6 @@ static void s3c_gpioWatch (uint seconds)
 
   while (cur_time <= fin_time)
   {
-    GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
     for (bank = 0; bank < 17; bank++) {
 
       B = bank*S3C_BANK_COLS;
@@ -441,6 +499,7 @@ static void s3c_gpioWatch (uint seconds)
 
     cur_time = time (NULL);
   }
+  memPhysUnmap (&pm);
 }
 
 static void
@@ -559,7 +618,13 @@ static void
 s3c_gpioDump(const char *tok, const char *args)
 {
   const uint rows = 187/4 +1;
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+  {
+    Output(C_ERROR "Unable to map GPIO registers");
+    return;
+  }
   int direction, pullupdown;
   char dir, sdir, pud, spud;
   uint B, bank;
@@ -663,6 +728,7 @@ s3c_gpioDump(const char *tok, const char *args)
     }
 */    
 
+  memPhysUnmap (&pm);
 }
 REG_DUMP(testS3C64xx, "GPIOS", s3c_gpioDump,
          "GPIOS\n"
@@ -672,7 +738,13 @@ REG_DUMP(testS3C64xx, "GPIOS", s3c_gpioDump,
 static void
 s3c_gpioOutputs(const char *tok, const char *args)
 {
-  uint32 *GPIO = (uint32 *)memPhysMap (S3C6400_PA_GPIO);
+  struct physMapping pm;
+  uint32 *GPIO = s3c_gpioMap (&pm);
+  if (!GPIO)
+  {
+    Output(C_ERROR "Unable to map GPIO registers");
+    return;
+  }
   int direction; char dir, writeable;
   uint B, bank;
   uint32 addr,data,mask,gpio;
@@ -705,6 +777,7 @@ s3c_gpioOutputs(const char *tok, const char *args)
           Output(" %3d %c%02d %c %c %c", gpio, (bank+'A'), gpio - S3C6410_BANKS[B + S3C_BANK_GPIO], dir, data?'1':' ', writeable);
       }
   }
+  memPhysUnmap (&pm);
 }
 REG_DUMP(testS3C64xx, "GPIOSOUT", s3c_gpioOutputs,
          "GPIOSOUT\n"
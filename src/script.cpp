@@ -17,6 +17,7 @@
 #include "cbitmap.h" // TEST/SET/CLEARBIT
 #include "output.h" // Output, fnprepare
 #include "exceptions.h" // TRY_EXCEPTION_HANDLER
+#include "memory.h" // memPhysThreadDone
 #include "script.h"
 
 
@@ -1001,6 +1002,7 @@ bgRun(char *args)
     prepThread();
     redir(args);
     free(args);
+    memPhysThreadDone();
 }
 
 static void
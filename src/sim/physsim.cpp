@@ -0,0 +1,286 @@
+/* Linux host simulation of the physical memory primitives.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+// This file is built for the host (see "make physsim") - it lets the
+// memory routines run against a file instead of a real device.  Each
+// mapPhys call creates a new shared mapping of the backing file, so
+// windows alias each other the same way VirtualCopy windows do.
+
+#include <stdio.h> // fprintf
+#include <stdlib.h> // mkstemp, malloc
+#include <string.h> // memset
+#include <unistd.h> // ftruncate, pread
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap
+
+#include "xtypes.h"
+#include "memory.h" // struct pageAddrs, MMU_L1_*
+#include "physbackend.h"
+#include "physsim.h"
+
+#define SIM_PAGE_SIZE 4096
+#define SIM_SECTION_SIZE 0x100000
+
+// Keep mappings below 4GB so they fit in haret's uint32 addresses.
+#ifdef MAP_32BIT
+#define SIM_MAP_FLAGS MAP_32BIT
+#else
+#define SIM_MAP_FLAGS 0
+#endif
+
+static int SimFD = -1;
+static uint32 SimRamAddr, SimRamSize;
+static uint32 SimMMU, SimPID;
+// RAM frames in use by the simulated tables or allocPages.
+static uint8 *SimFrameUsed;
+static uint32 SimSeed = 1;
+
+// An area handed out by simAllocPages.
+struct simAlloc {
+    struct simAlloc *next;
+    void *data;
+    uint32 size, count;
+    uint32 frames[0];
+};
+static struct simAlloc *SimAllocs;
+static void simFreePages(void *data);
+
+int
+physSimInit(uint32 ramAddr, uint32 ramSize, const char *backing)
+{
+    physSimDone();
+    if (backing) {
+        SimFD = open(backing, O_RDWR | O_CREAT, 0644);
+    } else {
+        char tmpl[] = "/tmp/physsimXXXXXX";
+        SimFD = mkstemp(tmpl);
+        if (SimFD >= 0)
+            unlink(tmpl);
+    }
+    if (SimFD < 0) {
+        perror("physsim: open");
+        return -1;
+    }
+    // The file is sparse - only pages written to take up space.
+    if (ftruncate(SimFD, (off_t)1 << 32)) {
+        perror("physsim: ftruncate");
+        physSimDone();
+        return -1;
+    }
+    SimRamAddr = ramAddr & ~(SIM_SECTION_SIZE - 1);
+    SimRamSize = ramSize & ~(SIM_SECTION_SIZE - 1);
+    SimFrameUsed = (uint8 *)calloc(SimRamSize / SIM_PAGE_SIZE, 1);
+    if (!SimFrameUsed) {
+        physSimDone();
+        return -1;
+    }
+    return 0;
+}
+
+void
+physSimDone()
+{
+    while (SimAllocs)
+        simFreePages(SimAllocs->data);
+    free(SimFrameUsed);
+    SimFrameUsed = NULL;
+    if (SimFD >= 0)
+        close(SimFD);
+    SimFD = -1;
+    SimMMU = 0;
+}
+
+int
+physSimLoadImage(const char *filename, uint32 paddr)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+    static char buf[0x10000];
+    int total = 0;
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+        if (pwrite(SimFD, buf, len, (off_t)paddr + total) != len) {
+            perror("physsim: pwrite");
+            total = -1;
+            break;
+        }
+        total += len;
+    }
+    close(fd);
+    return total;
+}
+
+static void
+simWrite32(uint32 paddr, uint32 val)
+{
+    if (pwrite(SimFD, &val, 4, paddr) != 4)
+        perror("physsim: pwrite");
+}
+
+uint32
+physSimBuildMMU()
+{
+    uint32 top = SimRamAddr + SimRamSize;
+    uint32 l1 = top - 0x4000, l2 = top - 0x5000;
+    uint32 nrframes = SimRamSize / SIM_PAGE_SIZE;
+    memset(&SimFrameUsed[nrframes - 5], 1, 5);
+
+    static uint32 zero[4096];
+    if (pwrite(SimFD, zero, sizeof(zero), l1) != sizeof(zero))
+        perror("physsim: pwrite");
+    for (uint32 mb = 0; mb < SimRamSize / SIM_SECTION_SIZE; mb++) {
+        uint32 pa = SimRamAddr + mb * SIM_SECTION_SIZE;
+        uint32 desc = pa | MMU_L1_AP_MASK | MMU_L1_SECTION;
+        simWrite32(l1 + (0x800 + mb) * 4
+                   , desc | MMU_L1_CACHEABLE | MMU_L1_BUFFERABLE);
+        simWrite32(l1 + (0xa00 + mb) * 4, desc);
+    }
+    // Two 512K runs in swapped order - exercises the L2 extent code.
+    for (uint32 i = 0; i < 256; i++) {
+        uint32 pa = SimRamAddr + ((i + 128) & 255) * SIM_PAGE_SIZE;
+        simWrite32(l2 + i * 4, pa | 0xff0 | MMU_L2_CACHEABLE
+                   | MMU_L2_BUFFERABLE | MMU_L2_SMALLPAGE);
+    }
+    simWrite32(l1 + 0xc00 * 4, l2 | MMU_L1_COARSE_L2);
+    SimMMU = l1;
+    return l1;
+}
+
+void
+physSimSetMMU(uint32 mmu)
+{
+    SimMMU = mmu;
+}
+
+void
+physSimSetPID(uint32 pid)
+{
+    SimPID = pid;
+}
+
+
+/****************************************************************
+ * Backend
+ ****************************************************************/
+
+static uint8 *
+simMapPhys(uint32 paddr, uint32 size, int cached)
+{
+    if (SimFD < 0)
+        return NULL;
+    void *virt = mmap(NULL, size, PROT_READ | PROT_WRITE
+                      , MAP_SHARED | SIM_MAP_FLAGS, SimFD, paddr);
+    if (virt == MAP_FAILED)
+        return NULL;
+    return (uint8 *)virt;
+}
+
+static void
+simUnmapPhys(uint8 *virt, uint32 size)
+{
+    munmap(virt, size);
+}
+
+static uint32
+simMMUBase()
+{
+    return SimMMU;
+}
+
+static uint32
+simMVAddr(uint32 vaddr)
+{
+    if (vaddr <= 0x01ffffff)
+        vaddr |= SimPID << 25;
+    return vaddr;
+}
+
+static void
+simFreePages(void *data)
+{
+    struct simAlloc **pa = &SimAllocs;
+    while (*pa && (*pa)->data != data)
+        pa = &(*pa)->next;
+    struct simAlloc *a = *pa;
+    if (!a) {
+        fprintf(stderr, "physsim: freePages of unknown area %p\n", data);
+        return;
+    }
+    *pa = a->next;
+    for (uint32 i = 0; i < a->count; i++)
+        SimFrameUsed[a->frames[i]] = 0;
+    munmap(a->data, a->size);
+    free(a);
+}
+
+// Hand out free RAM frames in a scattered order (like a fragmented
+// WinCE heap) and map them virtually continuous.
+static void *
+simAllocPages(struct pageAddrs *pages, int pageCount)
+{
+    uint32 nrframes = SimRamSize / SIM_PAGE_SIZE;
+    if (SimFD < 0 || pageCount <= 0)
+        return NULL;
+    struct simAlloc *a = (struct simAlloc *)malloc(
+        sizeof(*a) + pageCount * sizeof(a->frames[0]));
+    if (!a)
+        return NULL;
+    uint8 *data = (uint8 *)mmap(NULL, pageCount * SIM_PAGE_SIZE, PROT_NONE
+                                , MAP_PRIVATE | MAP_ANONYMOUS | SIM_MAP_FLAGS
+                                , -1, 0);
+    if (data == MAP_FAILED) {
+        free(a);
+        return NULL;
+    }
+    a->data = data;
+    a->size = pageCount * SIM_PAGE_SIZE;
+    a->count = 0;
+    a->next = SimAllocs;
+    SimAllocs = a;
+
+    for (int i = 0; i < pageCount; i++) {
+        SimSeed = SimSeed * 1103515245 + 12345;
+        uint32 frame = (SimSeed >> 8) % nrframes, tries;
+        for (tries = 0; tries < nrframes; tries++) {
+            if (!SimFrameUsed[frame])
+                break;
+            if (++frame == nrframes)
+                frame = 0;
+        }
+        uint32 paddr = SimRamAddr + frame * SIM_PAGE_SIZE;
+        uint8 *virt = data + i * SIM_PAGE_SIZE;
+        if (tries == nrframes
+            || mmap(virt, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE
+                    , MAP_SHARED | MAP_FIXED, SimFD, paddr) == MAP_FAILED) {
+            fprintf(stderr, "physsim: failed to allocate %d pages\n"
+                    , pageCount);
+            simFreePages(data);
+            return NULL;
+        }
+        SimFrameUsed[frame] = 1;
+        a->frames[a->count++] = frame;
+        memset(virt, 0, SIM_PAGE_SIZE);
+        pages[i].physLoc = paddr;
+        pages[i].virtLoc = (char *)virt;
+    }
+    return data;
+}
+
+static struct physBackend SimBackend = {
+    "physsim",
+    simMapPhys,
+    simUnmapPhys,
+    simMMUBase,
+    simMVAddr,
+    simAllocPages,
+    simFreePages,
+};
+
+struct physBackend *PhysBackend = &SimBackend;
@@ -186,10 +186,15 @@ static struct uart_drv s3c2410_uarts =
 static int s3c24xxSetupLoad (void)
 {
   uint32 s3c_ver;
+  struct physMapping pm;
 
-  s3c_gpio = (uint32 *)memPhysMap(S3C2410_PA_GPIO);
+  s3c_gpio = (uint32 *)memPhysMapRange(&pm, S3C2410_PA_GPIO, 0x100);
+  if (s3c_gpio == NULL)
+    return -1;
 
   s3c_ver = s3c_readl(s3c_gpio, S3C2410_GSTATUS1);
+  memPhysUnmap(&pm);
+  s3c_gpio = NULL;
 
   switch (s3c_ver & S3C2410_GSTATUS1_IDMASK)
   {
@@ -223,8 +228,9 @@ static void s3c24xxShutdownDMA (void)
   volatile uint32 *ch;
   uint32 dmasktrig;
   int timeo;
+  struct physMapping pm;
 
-  channels = (volatile uint32 *)memPhysMap (S3C2410_PA_DMA);
+  channels = (volatile uint32 *)memPhysMapRange (&pm, S3C2410_PA_DMA, 4 * 0x40);
   if (channels == NULL)
     return;
 
@@ -252,6 +258,7 @@ static void s3c24xxShutdownDMA (void)
       }
     }
   }
+  memPhysUnmap (&pm);
 }
 
 static int s3c24xxShutdownPerihperals(void)
@@ -397,6 +397,8 @@ bool InitProgress(int dialogId, uint Max)
     progressFeedback.lastProgress = 0;
     progressFeedback.lastShownProgress = 0;
     progressFeedback.showStep = Max / PB_MAXSTEPS;
+    if (!progressFeedback.showStep)
+        progressFeedback.showStep = 1;
     SendMessage(progressFeedback.slider, TBM_SETRANGEMAX, TRUE, PB_MAXSTEPS);
     return true;
 }
@@ -420,6 +422,21 @@ bool AddProgress(int add)
     return SetProgress(progressFeedback.lastProgress + add);
 }
 
+// Replace the text shown above the progress bar.
+void SetProgressText(const char *fmt, ...)
+{
+    if (!progressFeedback.window)
+        return;
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    wchar_t wbuf[128];
+    mbstowcs(wbuf, buf, ARRAY_SIZE(wbuf));
+    SetDlgItemText(progressFeedback.window, DLG_PROGRESS_TEXT, wbuf);
+}
+
 void DoneProgress()
 {
     if (progressFeedback.window) {
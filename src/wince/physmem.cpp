@@ -0,0 +1,106 @@
+/* WinCE implementation of the physical memory primitives.
+ *
+ * This file may be distributed under the terms of the GNU GPL license.
+ */
+
+#include <windows.h>
+#include "pkfuncs.h" // VirtualCopy, LockPages
+
+#include "xtypes.h"
+#include "cpu.h" // cpuGetMMU, MVAddr
+#include "memory.h" // struct pageAddrs
+#include "output.h" // Output
+#include "physbackend.h"
+
+static uint8 *
+wceMapPhys(uint32 paddr, uint32 size, int cached)
+{
+    uint8 *virt = (uint8 *)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (!virt)
+        return NULL;
+    // Map requested physical memory to our virtual address hole
+    int ret = VirtualCopy((void *)virt, (void *)(paddr / 256), size
+                          , PAGE_READWRITE | PAGE_PHYSICAL
+                          | (cached ? 0 : PAGE_NOCACHE));
+    if (!ret) {
+        VirtualFree(virt, 0, MEM_RELEASE);
+        return NULL;
+    }
+    return virt;
+}
+
+static void
+wceUnmapPhys(uint8 *virt, uint32 size)
+{
+    // This can lock up -- dunno why :-(
+    VirtualFree(virt, 0, MEM_RELEASE);
+}
+
+static uint32
+wceMVAddr(uint32 vaddr)
+{
+    return MVAddr(vaddr);
+}
+
+static void
+wceFreePages(void *data)
+{
+    int ret = UnmapViewOfFile(data);
+    if (!ret)
+        Output(C_ERROR "UnmapViewOfFile failed %p (code %ld)"
+               , data, GetLastError());
+}
+
+static void *
+wceAllocPages(struct pageAddrs *pages, int pageCount)
+{
+    int pageBytes = pageCount * PAGE_SIZE;
+    HANDLE h = CreateFileMapping(
+        (HANDLE)INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        0, pageBytes, NULL);
+    if (!h) {
+        Output(C_ERROR "Failed to allocate %d pages (code %ld)"
+               , pageCount, GetLastError());
+        return NULL;
+    }
+
+    void *data = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, 0);
+    int ret = CloseHandle(h);
+    if (!data) {
+        Output(C_ERROR "Failed to map %d pages (code %ld)"
+               , pageCount, GetLastError());
+        return NULL;
+    }
+    if (!ret)
+        Output(C_WARN "CloseHandle failed (code %ld)", GetLastError());
+
+    DWORD pfns[pageCount];
+    ret = LockPages(data, pageBytes, pfns, LOCKFLAG_WRITE);
+    if (!ret) {
+        Output(C_ERROR "Failed to lock %d pages (code %ld)"
+               , pageCount, GetLastError());
+        wceFreePages(data);
+        return NULL;
+    }
+
+    // Find all the physical locations of the pages.
+    for (int i = 0; i < pageCount; i++) {
+        struct pageAddrs *pd = &pages[i];
+        pd->virtLoc = &((char *)data)[PAGE_SIZE * i];
+        pd->physLoc = pfns[i]; // XXX should: x << UserKInfo[KINX_PFN_SHIFT]
+    }
+
+    return data;
+}
+
+static struct physBackend WinCEBackend = {
+    "wince",
+    wceMapPhys,
+    wceUnmapPhys,
+    cpuGetMMU,
+    wceMVAddr,
+    wceAllocPages,
+    wceFreePages,
+};
+
+struct physBackend *PhysBackend = &WinCEBackend;
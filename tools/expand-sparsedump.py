@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+
+# Tool to turn a sparse memory dump written with haret's PWFS/VWFS
+# commands back into a flat image.
+#
+# This file may be distributed under the terms of the GNU GPL license.
+
+import sys
+import struct
+
+HEADER = "<8s5I"
+INDEX = "<2I"
+MAGIC = b"HRTSPRS1"
+UNIFORM = 0xffffffff
+UNREADABLE = 0xfffffffe
+
+def printUsage():
+    sys.stderr.write("Usage:\n   %s <sparse-dump> [<output-image>]\n"
+                     "Without an output file the page index is listed.\n"
+                     % (sys.argv[0],))
+    sys.exit(1)
+
+def readDump(f):
+    hsize = struct.calcsize(HEADER)
+    magic, addr, size, pagesize, pages, datapages = struct.unpack(
+        HEADER, f.read(hsize))
+    if magic != MAGIC:
+        sys.stderr.write("Not a sparse haret dump\n")
+        sys.exit(1)
+    isize = struct.calcsize(INDEX)
+    data = f.read(isize * pages)
+    index = [struct.unpack(INDEX, data[i*isize:(i+1)*isize])
+             for i in range(pages)]
+    return addr, size, pagesize, index, hsize + isize * pages
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        printUsage()
+    f = open(sys.argv[1], 'rb')
+    addr, size, pagesize, index, datastart = readDump(f)
+
+    if len(sys.argv) == 2:
+        print("Start %08x size %08x (%d pages of %d bytes)"
+              % (addr, size, len(index), pagesize))
+        for i in range(len(index)):
+            pos, fill = index[i]
+            if pos == UNIFORM:
+                desc = "filled with %08x" % (fill,)
+            elif pos == UNREADABLE:
+                desc = "unreadable"
+            else:
+                desc = "data page %d" % (pos,)
+            print("%08x %s" % (addr + i * pagesize, desc))
+        return
+
+    # Unreadable pages are written out as zeros.
+    out = open(sys.argv[2], 'wb')
+    for i in range(len(index)):
+        pos, fill = index[i]
+        if pos == UNIFORM:
+            page = struct.pack("<I", fill) * (pagesize // 4)
+        elif pos == UNREADABLE:
+            page = b"\0" * pagesize
+        else:
+            f.seek(datastart + pos * pagesize)
+            page = f.read(pagesize)
+        out.write(page[:min(pagesize, size - i * pagesize)])
+    out.close()
+
+if __name__ == '__main__':
+    main()